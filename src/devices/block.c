@@ -3,7 +3,9 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/thread.h"
 
 /* A block device. */
 struct block
@@ -17,10 +19,46 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    struct block *parent;               /* Device partitioned, or null. */
+    block_sector_t start;               /* First sector within PARENT. */
+
+    struct block_stats stats;           /* Statistics, under the queue_lock
+                                           of the device that serves them. */
+
+    /* Request queue, served by the device's I/O thread.  Unused in
+       a partition. */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct condition queue_ready;       /* Signaled when QUEUE gains one. */
+    struct list queue;                  /* Pending requests, oldest first. */
+    block_sector_t head;                /* Sector after the last served. */
+    bool io_thread_started;             /* Has the I/O thread been created? */
   };
 
+/* Request scheduling.
+
+   Each device has a queue of pending requests, served one batch
+   at a time by an I/O thread created on first use.  The thread
+   chooses the next request in C-LOOK order: the lowest-numbered
+   sector at or past the disk head, wrapping around to the lowest
+   sector overall once nothing lies ahead.  A request that has
+   waited DEADLINE_TICKS or longer is served first regardless, so
+   that a stream of requests ahead of the head cannot starve one
+   behind it.  Requests in the same direction that continue the
+   chosen one are merged into its batch, up to MERGE_MAX sectors,
+   and the batch goes to the driver as a single transfer.
+
+   A partition has no queue or thread of its own.  Its requests
+   are translated to sectors of the whole device and queued there,
+   so that one scheduler orders and merges all of the requests for
+   a disk.  Each request remembers the device it was submitted to,
+   which is also charged for it in the statistics. */
+
+/* Timer ticks a request may wait before it jumps the queue. */
+#define DEADLINE_TICKS (TIMER_FREQ / 2)
+
+/* Most sectors merged into one transfer. */
+#define MERGE_MAX 64
+
 /* List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 
@@ -28,6 +66,41 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static struct block *queue_block (struct block *);
+static void io_thread (void *block_);
+static struct block_request *choose_request (struct block *);
+static void complete_request (struct block_request *);
+static void record_transfer (struct block *, block_sector_t start,
+                             block_sector_t end, uint64_t service,
+                             struct list *batch);
+static void count_request (struct block_stats *,
+                           const struct block_request *, uint64_t now);
+static void print_stats (struct block *);
+static void print_histogram (const char *title,
+                             const unsigned long long hist[], size_t cnt);
+
+/* Returns the CPU's timestamp counter. */
+static inline uint64_t
+read_tsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Returns the histogram bucket for CYCLES, its base-2 logarithm. */
+static size_t
+log2_bucket (uint64_t cycles)
+{
+  size_t bucket = 0;
+
+  while (cycles > 1 && bucket < BLOCK_HIST_CNT - 1)
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+  return bucket;
+}
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +193,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multi (block, sector, &buffer, 1);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +204,309 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multi (block, sector, &buffer, 1);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK.
+   Sector SECTOR + I is stored in BUFFERS[I], which must have room
+   for BLOCK_SECTOR_SIZE bytes.  Devices that support it transfer
+   all of the sectors with a single command.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multi (struct block *block, block_sector_t sector,
+                  void *buffers[], size_t cnt)
+{
+  struct block_request req;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&req, false, sector, buffers, cnt, NULL, NULL);
+  block_submit (block, &req);
+  block_request_wait (&req);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK.
+   Sector SECTOR + I is written from BUFFERS[I], which must
+   contain BLOCK_SECTOR_SIZE bytes.  Returns after the block
+   device has acknowledged receiving all of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multi (struct block *block, block_sector_t sector,
+                   const void *buffers[], size_t cnt)
+{
+  struct block_request req;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&req, true, sector, (void **) buffers, cnt,
+                      NULL, NULL);
+  block_submit (block, &req);
+  block_request_wait (&req);
+}
+
+/* Initializes REQ to read CNT sectors starting at SECTOR into
+   BUFFERS, or to write them from BUFFERS if WRITE is true.  On
+   completion, DONE will be called with REQ and AUX; if DONE is
+   null, the submitter must call block_request_wait() instead. */
+void
+block_request_init (struct block_request *req, bool write,
+                    block_sector_t sector, void *buffers[], size_t cnt,
+                    block_done_func *done, void *aux)
+{
+  ASSERT (cnt > 0);
+
+  req->write = write;
+  req->sector = sector;
+  req->cnt = cnt;
+  req->buffers = buffers;
+  req->done = done;
+  req->aux = aux;
+  sema_init (&req->finished, 0);
+}
+
+/* Queues REQ on BLOCK and returns without waiting for it.  A
+   request for a partition goes to the queue of the device that
+   holds it. */
+void
+block_submit (struct block *block, struct block_request *req)
+{
+  size_t depth;
+
+  check_sector (block, req->sector);
+  check_sector (block, req->sector + req->cnt - 1);
+  ASSERT (!req->write || block->type != BLOCK_FOREIGN);
+
+  req->origin = block;
+  for (; block->parent != NULL; block = block->parent)
+    req->sector += block->start;
+
+  req->submit_time = timer_ticks ();
+  req->submit_tsc = read_tsc ();
+  lock_acquire (&block->queue_lock);
+  depth = list_size (&block->queue);
+  if (depth >= BLOCK_DEPTH_CNT)
+    depth = BLOCK_DEPTH_CNT - 1;
+  block->stats.depth[depth]++;
+  if (req->origin != block)
+    req->origin->stats.depth[depth]++;
+  if (!block->io_thread_started)
+    {
+      char name[sizeof block->name + 3];
+
+      snprintf (name, sizeof name, "%s-io", block->name);
+      if (thread_create (name, PRI_MAX, io_thread, block) == TID_ERROR)
+        PANIC ("%s: cannot start I/O thread", block->name);
+      block->io_thread_started = true;
+    }
+  list_push_back (&block->queue, &req->elem);
+  cond_signal (&block->queue_ready, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Waits for REQ, which must have been submitted without a
+   completion callback, to complete. */
+void
+block_request_wait (struct block_request *req)
+{
+  ASSERT (req->done == NULL);
+  sema_down (&req->finished);
+}
+
+/* I/O thread for BLOCK.  Serves batches of requests from BLOCK's
+   queue, forever. */
+static void
+io_thread (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct list batch;
+      struct block_request *req;
+      void *buffers[MERGE_MAX];
+      void **bufp;
+      block_sector_t start, end;
+      uint64_t tsc;
+      bool write;
+
+      /* Choose the next request and merge its successors. */
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_ready, &block->queue_lock);
+      list_init (&batch);
+      req = choose_request (block);
+      list_remove (&req->elem);
+      list_push_back (&batch, &req->elem);
+      start = req->sector;
+      end = req->sector + req->cnt;
+      write = req->write;
+      while (req != NULL && end - start < MERGE_MAX)
+        {
+          struct list_elem *e;
+
+          req = NULL;
+          for (e = list_begin (&block->queue); e != list_end (&block->queue);
+               e = list_next (e))
+            {
+              struct block_request *r = list_entry (e, struct block_request,
+                                                    elem);
+              if (r->sector == end && r->write == write
+                  && end - start + r->cnt <= MERGE_MAX)
+                {
+                  req = r;
+                  list_remove (&r->elem);
+                  list_push_back (&batch, &r->elem);
+                  end += r->cnt;
+                  break;
+                }
+            }
+        }
+      lock_release (&block->queue_lock);
+
+      /* Gather the buffers, unless the batch is a single request
+         whose own buffer array will do. */
+      req = list_entry (list_front (&batch), struct block_request, elem);
+      if (list_size (&batch) == 1)
+        bufp = req->buffers;
+      else
+        {
+          struct list_elem *e;
+          size_t cnt = 0;
+
+          for (e = list_begin (&batch); e != list_end (&batch);
+               e = list_next (e))
+            {
+              struct block_request *r = list_entry (e, struct block_request,
+                                                    elem);
+              memcpy (buffers + cnt, r->buffers, r->cnt * sizeof *buffers);
+              cnt += r->cnt;
+            }
+          bufp = buffers;
+        }
+
+      /* Transfer. */
+      tsc = read_tsc ();
+      if (write)
+        {
+          if (block->ops->write_multi != NULL)
+            block->ops->write_multi (block->aux, start,
+                                     (const void **) bufp, end - start);
+          else
+            {
+              block_sector_t s;
+              for (s = start; s < end; s++)
+                block->ops->write (block->aux, s, bufp[s - start]);
+            }
+        }
+      else
+        {
+          if (block->ops->read_multi != NULL)
+            block->ops->read_multi (block->aux, start, bufp, end - start);
+          else
+            {
+              block_sector_t s;
+              for (s = start; s < end; s++)
+                block->ops->read (block->aux, s, bufp[s - start]);
+            }
+        }
+      record_transfer (block, start, end, read_tsc () - tsc, &batch);
+
+      while (!list_empty (&batch))
+        complete_request (list_entry (list_pop_front (&batch),
+                                      struct block_request, elem));
+    }
+}
+
+/* Returns the request in BLOCK's queue, which must not be empty,
+   that should be served next.  The caller must hold BLOCK's
+   queue_lock. */
+static struct block_request *
+choose_request (struct block *block)
+{
+  struct block_request *oldest, *ahead = NULL, *lowest = NULL;
+  struct list_elem *e;
+
+  /* The queue is in arrival order, so the front has waited
+     longest. */
+  oldest = list_entry (list_front (&block->queue), struct block_request,
+                       elem);
+  if (timer_elapsed (oldest->submit_time) >= DEADLINE_TICKS)
+    return oldest;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->sector >= block->head
+          && (ahead == NULL || r->sector < ahead->sector))
+        ahead = r;
+      if (lowest == NULL || r->sector < lowest->sector)
+        lowest = r;
+    }
+  return ahead != NULL ? ahead : lowest;
+}
+
+/* Updates the statistics of BLOCK, and of the device that the
+   first request in BATCH was submitted to, for a transfer of
+   sectors START through END - 1 that took SERVICE timestamp
+   counter cycles and completed the requests in BATCH.  Each
+   request is also counted for its own device.  Also moves
+   BLOCK's head past the transfer. */
+static void
+record_transfer (struct block *block, block_sector_t start,
+                 block_sector_t end, uint64_t service,
+                 struct list *batch)
+{
+  struct block *origin = list_entry (list_front (batch),
+                                     struct block_request, elem)->origin;
+  struct block_stats *sts[2] = { &block->stats, &origin->stats };
+  size_t st_cnt = origin != block ? 2 : 1;
+  uint64_t now = read_tsc ();
+  struct list_elem *e;
+  size_t i;
+
+  lock_acquire (&block->queue_lock);
+  for (i = 0; i < st_cnt; i++)
+    {
+      sts[i]->transfer_cnt++;
+      if (start == block->head)
+        sts[i]->seq_cnt++;
+      sts[i]->service[log2_bucket (service)]++;
+    }
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      count_request (&block->stats, r, now);
+      if (r->origin != block)
+        count_request (&r->origin->stats, r, now);
+    }
+  block->head = end;
+  lock_release (&block->queue_lock);
+}
+
+/* Counts REQ, which completed at timestamp counter NOW, in ST. */
+static void
+count_request (struct block_stats *st, const struct block_request *req,
+               uint64_t now)
+{
+  if (req->write)
+    st->write_cnt += req->cnt;
+  else
+    st->read_cnt += req->cnt;
+  st->latency[log2_bucket (now - req->submit_tsc)]++;
+}
+
+/* Reports that REQ has completed.  REQ may be freed by its
+   owner as soon as this happens. */
+static void
+complete_request (struct block_request *req)
+{
+  if (req->done != NULL)
+    req->done (req, req->aux);
+  else
+    sema_up (&req->finished);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,24 +530,84 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Copies BLOCK's statistics into *STATS.  May be called at any
+   time. */
+void
+block_get_stats (struct block *block, struct block_stats *stats)
+{
+  struct block *queue = queue_block (block);
+
+  lock_acquire (&queue->queue_lock);
+  *stats = block->stats;
+  lock_release (&queue->queue_lock);
+}
+
+/* Prints statistics for each block device used for a Pintos role,
+   then for each other device whose queue served requests, such as
+   a disk holding those devices as partitions. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
+    if (block_by_role[i] != NULL)
+      print_stats (block_by_role[i]);
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
     {
-      struct block *block = block_by_role[i];
-      if (block != NULL)
-        {
-          printf ("%s (%s): %llu reads, %llu writes\n",
-                  block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
-        }
+      struct block *block = list_entry (e, struct block, list_elem);
+
+      if (!block->io_thread_started)
+        continue;
+      for (i = 0; i < BLOCK_ROLE_CNT; i++)
+        if (block_by_role[i] == block)
+          break;
+      if (i == BLOCK_ROLE_CNT)
+        print_stats (block);
     }
 }
 
+/* Prints BLOCK's statistics. */
+static void
+print_stats (struct block *block)
+{
+  struct block_stats st;
+
+  block_get_stats (block, &st);
+  printf ("%s (%s): %llu reads, %llu writes\n",
+          block->name, block_type_name (block->type),
+          st.read_cnt, st.write_cnt);
+  if (st.transfer_cnt == 0)
+    return;
+  printf ("  %llu kB read, %llu kB written in %llu transfers, "
+          "%llu%% sequential\n",
+          st.read_cnt * BLOCK_SECTOR_SIZE / 1024,
+          st.write_cnt * BLOCK_SECTOR_SIZE / 1024,
+          st.transfer_cnt, st.seq_cnt * 100 / st.transfer_cnt);
+  print_histogram ("service time, log2 cycles", st.service, BLOCK_HIST_CNT);
+  print_histogram ("request latency, log2 cycles", st.latency,
+                   BLOCK_HIST_CNT);
+  print_histogram ("queue depth at submit", st.depth, BLOCK_DEPTH_CNT);
+}
+
+/* Prints the nonzero buckets of histogram HIST, which has CNT
+   buckets, on one line headed by TITLE. */
+static void
+print_histogram (const char *title, const unsigned long long hist[],
+                 size_t cnt)
+{
+  size_t i;
+
+  printf ("  %s:", title);
+  for (i = 0; i < cnt; i++)
+    if (hist[i] != 0)
+      printf (" %zu:%llu", i, hist[i]);
+  printf ("\n");
+}
+
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
@@ -198,8 +628,14 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  memset (&block->stats, 0, sizeof block->stats);
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_ready);
+  list_init (&block->queue);
+  block->parent = NULL;
+  block->start = 0;
+  block->head = 0;
+  block->io_thread_started = false;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +647,34 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Registers a new block device with the given NAME, TYPE and
+   EXTRA_INFO, as block_register() does, for the SIZE sectors of
+   PARENT that begin at sector START.  Its requests are served by
+   PARENT's queue. */
+struct block *
+block_register_partition (const char *name, enum block_type type,
+                          const char *extra_info, struct block *parent,
+                          block_sector_t start, block_sector_t size)
+{
+  struct block *block;
+
+  ASSERT (start + size >= start && start + size <= parent->size);
+
+  block = block_register (name, type, extra_info, size, NULL, NULL);
+  block->parent = parent;
+  block->start = start;
+  return block;
+}
+
+/* Returns the device whose queue serves BLOCK's requests. */
+static struct block *
+queue_block (struct block *block)
+{
+  while (block->parent != NULL)
+    block = block->parent;
+  return block;
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
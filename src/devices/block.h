@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,22 +55,95 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t, void *buffers[],
+                       size_t cnt);
+void block_write_multi (struct block *, block_sector_t,
+                        const void *buffers[], size_t cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests.
+
+   A request transfers CNT consecutive sectors starting at SECTOR,
+   each to or from its own buffer in BUFFERS.  Once submitted, it
+   waits in its device's queue until the device's I/O thread
+   serves it.  A partition's requests wait in the queue of the
+   device it is part of, with SECTOR translated to match.  When it completes, DONE is called from that thread,
+   or if DONE is null then block_request_wait() returns.  The
+   request and its buffers must stay valid until then. */
+struct block_request;
+typedef void block_done_func (struct block_request *, void *aux);
+
+struct block_request
+  {
+    struct list_elem elem;              /* Element in device queue. */
+    struct block *origin;               /* Device submitted to. */
+    bool write;                         /* Write or read? */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void **buffers;                     /* Buffer for each sector. */
+    int64_t submit_time;                /* Timer ticks when submitted. */
+    uint64_t submit_tsc;                /* Timestamp counter then. */
+    block_done_func *done;              /* Completion callback. */
+    void *aux;                          /* Passed to DONE. */
+    struct semaphore finished;          /* Up'd on completion if no DONE. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, void *buffers[], size_t cnt,
+                         block_done_func *, void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_request_wait (struct block_request *);
+
 /* Statistics. */
+
+/* Histograms are indexed by the base-2 logarithm of a time in
+   CPU timestamp counter cycles, or by queue depth up to
+   BLOCK_DEPTH_CNT - 1, with deeper queues counted in the last
+   bucket. */
+#define BLOCK_HIST_CNT 40
+#define BLOCK_DEPTH_CNT 16
+
+struct block_stats
+  {
+    unsigned long long read_cnt;        /* Number of sectors read. */
+    unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long transfer_cnt;    /* Driver transfers. */
+    unsigned long long seq_cnt;         /* Transfers that began where the
+                                           previous one ended. */
+    unsigned long long service[BLOCK_HIST_CNT]; /* Transfers by duration. */
+    unsigned long long latency[BLOCK_HIST_CNT]; /* Requests by time from
+                                                   submit to completion. */
+    unsigned long long depth[BLOCK_DEPTH_CNT];  /* Requests by number
+                                                   already queued. */
+  };
+
+void block_get_stats (struct block *, struct block_stats *);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* READ_MULTI and WRITE_MULTI transfer CNT consecutive sectors
+   starting at the given sector, each to or from its own buffer in
+   BUFFERS.  A driver that leaves them null gets one READ or WRITE
+   call per sector instead. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multi) (void *aux, block_sector_t, void *buffers[],
+                        size_t cnt);
+    void (*write_multi) (void *aux, block_sector_t, const void *buffers[],
+                         size_t cnt);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+struct block *block_register_partition (const char *name, enum block_type,
+                                        const char *extra_info,
+                                        struct block *parent,
+                                        block_sector_t start,
+                                        block_sector_t size);
 
 #endif /* devices/block.h */
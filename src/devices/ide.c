@@ -9,6 +9,7 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +35,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +51,47 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Bus master IDE registers, at an offset from the channel's
+   `bm_base'.  Found on PIIX and compatible controllers. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_START 0x01           /* Start/stop bus master. */
+#define BM_READ 0x08            /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_ACTIVE 0x01          /* Transfer in progress. */
+#define BM_ERROR 0x02           /* Transfer failed. */
+#define BM_INTR 0x04            /* Disk raised its interrupt. */
+
+/* PCI configuration space access ports. */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Physical Region Descriptor.  A table of these tells the bus
+   master which memory to transfer to or from.  A region may not
+   cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, even. */
+    uint16_t size;              /* Byte count, even; 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last entry. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_CNT 64              /* Entries per table. */
+
+/* Most sectors that one command can transfer.  Writing 0 to the
+   Sector Count register asks for this many. */
+#define MAX_SECTORS_PER_CMD 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +100,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int block_sectors;          /* Sectors per interrupt; 1 unless READ
+                                   and WRITE MULTIPLE are enabled. */
+    bool dma;                   /* Use bus master DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -72,6 +118,9 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master I/O port, 0 if none. */
+    struct prd *prdt;           /* PRD table for DMA. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -79,13 +128,29 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* One PRD table per channel.  Aligning each table to its own
+   size keeps it from crossing a 64 kB boundary, as required. */
+static struct prd prd_tables[CHANNEL_CNT][PRD_CNT]
+  __attribute__ ((aligned (PRD_CNT * sizeof (struct prd))));
+
 static struct block_operations ide_operations;
 
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
-
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, int block_sectors);
+static uint16_t find_bus_master (void);
+static uint32_t pci_read_config (int dev, int func, int reg);
+static void pci_write_config (int dev, int func, int reg, uint32_t);
+
+static bool dma_transfer (struct ata_disk *, block_sector_t,
+                          const void *buffers[], size_t cnt, bool write);
+static void pio_read (struct ata_disk *, block_sector_t,
+                      void *buffers[], size_t cnt);
+static void pio_write (struct ata_disk *, block_sector_t,
+                       const void *buffers[], size_t cnt);
+
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -101,6 +166,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +192,8 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->prdt = prd_tables[chan_no];
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +204,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->block_sectors = 1;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -303,12 +373,39 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Transfer as many sectors per interrupt as the disk allows.
+     Use DMA if both the disk and the controller can. */
+  set_multiple_mode (d, (uint8_t) id[47 * 2]);
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & (1 << 8)) != 0;
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
 
+/* Asks disk D to transfer BLOCK_SECTORS sectors per interrupt
+   in READ MULTIPLE and WRITE MULTIPLE commands, the largest
+   number it supports according to IDENTIFY DEVICE.  If the disk
+   refuses or does not support those commands, D keeps
+   transferring one sector per interrupt. */
+static void
+set_multiple_mode (struct ata_disk *d, int block_sectors)
+{
+  struct channel *c = d->channel;
+
+  if (block_sectors <= 1)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), block_sectors);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) == 0)
+    d->block_sectors = block_sectors;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +434,293 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads CNT sectors starting at SEC_NO from disk D, sector
+   SEC_NO + I into BUFFERS[I], each of which must have room for
+   BLOCK_SECTOR_SIZE bytes.  Issues one command per
+   MAX_SECTORS_PER_CMD sectors, using DMA where possible.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multi (void *d_, block_sector_t sec_no, void *buffers[],
+                size_t cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_SECTORS_PER_CMD ? cnt : MAX_SECTORS_PER_CMD;
+
+      if (!dma_transfer (d, sec_no, (const void **) buffers, n, false))
+        pio_read (d, sec_no, buffers, n);
+
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
+/* Writes CNT sectors starting at SEC_NO to disk D, sector
+   SEC_NO + I from BUFFERS[I], each of which must contain
    BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+   acknowledged receiving all of the data.  Issues one command
+   per MAX_SECTORS_PER_CMD sectors, using DMA where possible.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multi (void *d_, block_sector_t sec_no, const void *buffers[],
+                 size_t cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_SECTORS_PER_CMD ? cnt : MAX_SECTORS_PER_CMD;
+
+      if (!dma_transfer (d, sec_no, buffers, n, true))
+        pio_write (d, sec_no, buffers, n);
+
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFERS
+   in PIO mode, taking one interrupt per D->block_sectors
+   sectors.  CNT must be at most MAX_SECTORS_PER_CMD.  The caller
+   must hold the channel's lock. */
+static void
+pio_read (struct ata_disk *d, block_sector_t sec_no, void *buffers[],
+          size_t cnt)
+{
+  struct channel *c = d->channel;
+  size_t i;
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, (d->block_sectors > 1
+                         ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY));
+  for (i = 0; i < cnt; i++)
+    {
+      /* Each block of sectors is announced by an interrupt. */
+      if (i % d->block_sectors == 0)
+        {
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+        }
+      input_sector (c, buffers[i]);
+    }
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFERS
+   in PIO mode.  CNT must be at most MAX_SECTORS_PER_CMD.  The
+   caller must hold the channel's lock. */
+static void
+pio_write (struct ata_disk *d, block_sector_t sec_no, const void *buffers[],
+           size_t cnt)
+{
+  struct channel *c = d->channel;
+  size_t i;
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, (d->block_sectors > 1
+                         ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY));
+  for (i = 0; i < cnt; i++)
+    {
+      /* The disk asks for each block of sectors in turn and
+         interrupts once it has taken the block. */
+      if (i % d->block_sectors == 0 && !wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu,
+               d->name, sec_no + i);
+      output_sector (c, buffers[i]);
+      if ((i + 1) % d->block_sectors == 0 || i + 1 == cnt)
+        sema_down (&c->completion_wait);
+    }
+}
+
+/* Fills channel C's PRD table to describe the CNT sectors in
+   BUFFERS, merging buffers that are adjacent in physical memory.
+   Returns false if a buffer is unsuitable for DMA or the table
+   is too small. */
+static bool
+build_prdt (struct channel *c, const void *buffers[], size_t cnt)
+{
+  struct prd *prd = NULL;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      uintptr_t addr, end;
+
+      if (!is_kernel_vaddr (buffers[i]) || (uintptr_t) buffers[i] & 1)
+        return false;
+      addr = vtop (buffers[i]);
+      end = addr + BLOCK_SECTOR_SIZE;
+      while (addr < end)
+        {
+          /* Bytes up to the next 64 kB boundary. */
+          uintptr_t limit = (addr | 0xffff) + 1;
+          size_t size = (end < limit ? end : limit) - addr;
+
+          if (prd != NULL && prd->addr + (prd->size ? prd->size : 0x10000)
+              == addr && ((addr & 0xffff) != 0))
+            prd->size += size;
+          else
+            {
+              prd = prd == NULL ? c->prdt : prd + 1;
+              if (prd >= c->prdt + PRD_CNT)
+                return false;
+              prd->addr = addr;
+              prd->size = size;
+              prd->flags = 0;
+            }
+          addr += size;
+        }
+    }
+  prd->flags = PRD_EOT;
+  return true;
+}
+
+/* Transfers CNT sectors starting at SEC_NO between disk D and
+   BUFFERS by bus master DMA, writing to the disk if WRITE is true
+   and reading from it otherwise.  The CPU is free to run other
+   threads until the disk interrupts at the end.  Returns false
+   without transferring anything if DMA cannot be used for these
+   buffers, or if the transfer failed, in which case DMA is
+   turned off for D.  CNT must be at most MAX_SECTORS_PER_CMD.
+   The caller must hold the channel's lock. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no,
+              const void *buffers[], size_t cnt, bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t bm_status;
+
+  if (!d->dma || !build_prdt (c, buffers, cnt))
+    return false;
+
+  /* Program the bus master, then the disk, then start. */
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), write ? 0 : BM_READ);
+  outb (reg_bm_status (c), BM_ERROR | BM_INTR);
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), (write ? 0 : BM_READ) | BM_START);
+
+  sema_down (&c->completion_wait);
+  outb (reg_bm_command (c), 0);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), BM_ERROR | BM_INTR);
+
+  if ((bm_status & (BM_ERROR | BM_ACTIVE))
+      || (inb (reg_alt_status (c)) & STA_ERR))
+    {
+      printf ("%s: DMA transfer failed, sector=%"PRDSNu", "
+              "falling back to PIO\n", d->name, sec_no);
+      d->dma = false;
+      return false;
+    }
+  return true;
+}
+
+/* Returns the I/O port of the bus master registers of the first
+   PCI IDE controller that operates in legacy mode and can act as
+   a bus master, enabling bus mastering in the process.  Returns
+   0 if there is no such controller. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar4;
+
+        /* Mass storage, IDE, bus master capable, both channels
+           in compatibility mode. */
+        class = pci_read_config (dev, func, 0x08);
+        if (class >> 16 != 0x0101 || (class & 0x8500) != 0x8000)
+          continue;
+        bar4 = pci_read_config (dev, func, 0x20);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Allow the controller to master the bus. */
+        pci_write_config (dev, func, 0x04,
+                          pci_read_config (dev, func, 0x04) | 0x04);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
+/* Reads the 32-bit PCI configuration register at offset REG of
+   function FUNC of device DEV on bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDRESS, 0x80000000 | dev << 11 | func << 8 | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit PCI configuration register at offset
+   REG of function FUNC of device DEV on bus 0. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDRESS, 0x80000000 | dev << 11 | func << 8 | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multi (d, sec_no, &buffer, 1);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multi (d, sec_no, &buffer, 1);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multi,
+    ide_write_multi
   };
-
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the number of sectors to transfer, CNT, to
+   the disk's sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_CMD);
+  ASSERT (sec_no + cnt <= (1UL << 28));
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_SECTORS_PER_CMD ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
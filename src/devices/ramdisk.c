@@ -0,0 +1,85 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device whose sectors live in kernel memory.
+
+   It is registered as a raw device named "ram0", so it plays a
+   role only when named explicitly, e.g. "-filesys=ram0".  Its
+   contents start out zeroed and are lost at power-off.  Because
+   it has no seek or transfer latency, it lets the CPU cost of
+   the file system be measured on its own, and lets scratch or
+   swap run at memory speed.
+
+   Memory comes one page at a time, so a large disk does not need
+   physically contiguous memory. */
+
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static uint8_t **pages;                 /* Pages holding the sectors. */
+
+static struct block_operations ramdisk_operations;
+
+/* Creates a RAM disk of KB kilobytes, rounded up to a whole
+   number of pages, and registers it.  Panics if memory runs
+   out. */
+void
+ramdisk_init (size_t kb)
+{
+  size_t page_cnt = DIV_ROUND_UP (kb * 1024, PGSIZE);
+  size_t i;
+
+  ASSERT (pages == NULL);
+  if (page_cnt == 0)
+    return;
+
+  pages = malloc (page_cnt * sizeof *pages);
+  if (pages == NULL)
+    PANIC ("ram0: out of memory for %zu pages", page_cnt);
+  for (i = 0; i < page_cnt; i++)
+    {
+      pages[i] = palloc_get_page (PAL_ZERO);
+      if (pages[i] == NULL)
+        PANIC ("ram0: out of memory after %zu of %zu pages", i, page_cnt);
+    }
+
+  block_register ("ram0", BLOCK_RAW, "RAM disk",
+                  page_cnt * SECTORS_PER_PAGE, &ramdisk_operations, NULL);
+}
+
+/* Returns the address of SEC_NO in memory. */
+static uint8_t *
+sector_addr (block_sector_t sec_no)
+{
+  return pages[sec_no / SECTORS_PER_PAGE]
+         + sec_no % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE;
+}
+
+/* Reads sector SEC_NO into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_read (void *aux UNUSED, block_sector_t sec_no, void *buffer)
+{
+  memcpy (buffer, sector_addr (sec_no), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes BUFFER, which must contain BLOCK_SECTOR_SIZE bytes, to
+   sector SEC_NO. */
+static void
+ramdisk_write (void *aux UNUSED, block_sector_t sec_no, const void *buffer)
+{
+  memcpy (sector_addr (sec_no), buffer, BLOCK_SECTOR_SIZE);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    NULL,
+    NULL
+  };
@@ -0,0 +1,570 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Buffer cache for the file system device.
+
+   Holds up to CACHE_CNT sectors of fs_device in memory.  Every
+   read and write of file system sectors goes through the cache,
+   so a sector that was read recently or that is still being
+   streamed through is served without touching the disk.
+
+   Writes only update the cached copy and mark it dirty.  Dirty
+   sectors reach the disk when they are evicted, or when the
+   "write-behind" thread flushes the whole cache, which it does
+   every WRITE_BEHIND_TICKS timer ticks.  filesys_done() flushes
+   the cache one last time before the machine powers off.
+
+   Sectors that are likely to be read next can be queued with
+   cache_read_ahead().  A background "read-ahead" thread loads
+   them into the cache, so a process that reads a file
+   sequentially overlaps the disk's latency with its own work.
+
+   Runs of consecutive sectors are transferred with one
+   multi-sector request where possible: cache_flush() writes
+   adjacent dirty sectors together, the read-ahead thread loads
+   adjacent queued sectors together, and cache_read_multi() loads
+   the missing sectors of a large read together.  Both submit their
+   requests without waiting for each one in turn, so that the
+   block layer can sort them into disk order.
+
+   One lock protects the whole cache.  Disk I/O is never done
+   while holding it: an entry being read or written is marked
+   busy instead, and anyone else who wants it waits on
+   `io_done'. */
+
+/* Number of cached sectors. */
+#define CACHE_CNT 64
+
+/* Timer ticks between flushes by the write-behind thread. */
+#define WRITE_BEHIND_TICKS TIMER_FREQ
+
+/* Maximum number of queued read-ahead requests.  Further
+   requests are dropped while the queue is full. */
+#define READ_AHEAD_MAX 32
+
+/* Most sectors moved by one multi-sector request. */
+#define RUN_MAX 16
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held in DATA. */
+    bool in_use;                        /* Does DATA hold SECTOR? */
+    bool busy;                          /* Disk I/O in progress? */
+    bool accessed;                      /* Used since last clock pass? */
+    bool dirty;                         /* Newer than the disk copy? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+/* A run of consecutive cached sectors being read or written. */
+struct cache_io
+  {
+    struct block_request req;           /* Block request. */
+    struct list_elem elem;              /* Element in a pending list. */
+    size_t cnt;                         /* Number of sectors. */
+    struct cache_entry *run[RUN_MAX];   /* Entries, all busy. */
+    void *buffers[RUN_MAX];             /* Their data. */
+  };
+
+static struct cache_entry cache[CACHE_CNT];
+static struct lock cache_lock;          /* Protects everything here. */
+static struct condition io_done;        /* Signaled when I/O finishes. */
+static size_t clock_hand;               /* Next eviction candidate. */
+
+/* Read-ahead queue, a ring buffer of sectors. */
+static block_sector_t read_ahead_queue[READ_AHEAD_MAX];
+static size_t read_ahead_head, read_ahead_cnt;
+static struct condition read_ahead_ready;
+
+static struct cache_entry *lookup (block_sector_t);
+static struct cache_entry *get_entry (block_sector_t, bool load);
+static struct cache_entry *evict (void);
+static void write_back (struct cache_entry *);
+static void claim_dirty_run (struct cache_entry *, struct cache_io *);
+static void finish_run (struct cache_io *);
+static void write_back_run (struct cache_entry *);
+static void claim_load_run (block_sector_t, size_t cnt, struct cache_io *);
+static void load_run (block_sector_t, size_t cnt);
+static block_done_func load_done;
+static void read_ahead_daemon (void *aux);
+static void write_behind_daemon (void *aux);
+
+/* Initializes the buffer cache and starts the read-ahead and
+   write-behind threads. */
+void
+cache_init (void)
+{
+  lock_init (&cache_lock);
+  cond_init (&io_done);
+  cond_init (&read_ahead_ready);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+  thread_create ("write-behind", PRI_DEFAULT, write_behind_daemon, NULL);
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = get_entry (sector, true);
+  memcpy (buffer, e->data, BLOCK_SECTOR_SIZE);
+  lock_release (&cache_lock);
+}
+
+/* Writes SECTOR from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes, to the cache.  The sector is written
+   to disk later. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = get_entry (sector, false);
+  memcpy (e->data, buffer, BLOCK_SECTOR_SIZE);
+  e->dirty = true;
+  lock_release (&cache_lock);
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within SECTOR
+   into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  e = get_entry (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  lock_release (&cache_lock);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Sectors that are not yet cached are read from disk together,
+   RUN_MAX at a time, rather than one request per sector. */
+void
+cache_read_multi (block_sector_t sector, void *buffer_, size_t cnt)
+{
+  uint8_t *buffer = buffer_;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_entry *e = lookup (sector + i);
+      if (e == NULL)
+        {
+          struct cache_io io;
+
+          claim_load_run (sector + i, cnt - i < RUN_MAX ? cnt - i : RUN_MAX,
+                          &io);
+          if (io.cnt > 0)
+            {
+              block_request_init (&io.req, false, sector + i, io.buffers,
+                                  io.cnt, NULL, NULL);
+              lock_release (&cache_lock);
+              block_submit (fs_device, &io.req);
+              block_request_wait (&io.req);
+              lock_acquire (&cache_lock);
+              finish_run (&io);
+            }
+        }
+      e = get_entry (sector + i, true);
+      memcpy (buffer + i * BLOCK_SECTOR_SIZE, e->data, BLOCK_SECTOR_SIZE);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at byte
+   offset OFS.  The rest of the sector is left unchanged. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  e = get_entry (sector, ofs > 0 || size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  lock_release (&cache_lock);
+}
+
+/* Writes every dirty sector in the cache to disk.  All of the
+   writes are queued before waiting for any of them. */
+void
+cache_flush (void)
+{
+  struct list pending;
+  struct cache_entry *e;
+
+  list_init (&pending);
+  lock_acquire (&cache_lock);
+  for (e = cache; e < cache + CACHE_CNT; e++)
+    if (e->in_use && e->dirty && !e->busy)
+      {
+        struct cache_io *io = malloc (sizeof *io);
+        if (io == NULL)
+          {
+            write_back_run (e);
+            continue;
+          }
+        claim_dirty_run (e, io);
+        block_submit (fs_device, &io->req);
+        list_push_back (&pending, &io->elem);
+      }
+  lock_release (&cache_lock);
+
+  while (!list_empty (&pending))
+    {
+      struct cache_io *io = list_entry (list_pop_front (&pending),
+                                        struct cache_io, elem);
+      block_request_wait (&io->req);
+      lock_acquire (&cache_lock);
+      finish_run (io);
+      lock_release (&cache_lock);
+      free (io);
+    }
+}
+
+/* Writes every dirty sector in the cache to disk for shutdown.
+   Unlike cache_flush(), also waits for I/O that others started,
+   such as a write-behind or an eviction, and flushes again if
+   that left anything dirty, until no entry is dirty or busy. */
+void
+cache_done (void)
+{
+  struct cache_entry *e;
+
+  for (;;)
+    {
+      cache_flush ();
+
+      lock_acquire (&cache_lock);
+      for (e = cache; e < cache + CACHE_CNT; e++)
+        if (e->in_use && (e->dirty || e->busy))
+          break;
+      if (e == cache + CACHE_CNT)
+        break;
+      while (e->busy)
+        cond_wait (&io_done, &cache_lock);
+      lock_release (&cache_lock);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache.
+   Does not wait for it to happen. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&cache_lock);
+  if (read_ahead_cnt < READ_AHEAD_MAX && lookup (sector) == NULL)
+    {
+      read_ahead_queue[(read_ahead_head + read_ahead_cnt++)
+                       % READ_AHEAD_MAX] = sector;
+      cond_signal (&read_ahead_ready, &cache_lock);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Returns the entry that holds SECTOR, or a null pointer if
+   SECTOR is not cached.  The entry may be busy.  The caller must
+   hold cache_lock. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  for (e = cache; e < cache + CACHE_CNT; e++)
+    if (e->in_use && e->sector == sector)
+      return e;
+  return NULL;
+}
+
+/* Returns a non-busy entry that holds SECTOR, bringing SECTOR
+   into the cache if necessary.  If LOAD is false, a newly
+   allocated entry's data is left uninitialized, because the
+   caller is about to overwrite all of it.  The caller must hold
+   cache_lock, which may be released and reacquired. */
+static struct cache_entry *
+get_entry (block_sector_t sector, bool load)
+{
+  struct cache_entry *e;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;)
+    {
+      e = lookup (sector);
+      if (e != NULL)
+        {
+          if (!e->busy)
+            break;
+          cond_wait (&io_done, &cache_lock);
+          continue;
+        }
+
+      e = evict ();
+      if (e == NULL)
+        {
+          cond_wait (&io_done, &cache_lock);
+          continue;
+        }
+
+      /* Writing back the evicted sector released the lock, so
+         someone else may have brought SECTOR in meanwhile. */
+      if (lookup (sector) != NULL)
+        continue;
+
+      e->sector = sector;
+      e->in_use = true;
+      e->dirty = false;
+      if (load)
+        {
+          e->busy = true;
+          lock_release (&cache_lock);
+          block_read (fs_device, sector, e->data);
+          lock_acquire (&cache_lock);
+          e->busy = false;
+          cond_broadcast (&io_done, &cache_lock);
+        }
+      break;
+    }
+
+  e->accessed = true;
+  return e;
+}
+
+/* Frees an entry, using the clock algorithm to choose among
+   entries in use, and returns it.  Returns a null pointer if
+   every entry is busy.  The caller must hold cache_lock, which
+   is released and reacquired if a dirty sector must be written
+   back. */
+static struct cache_entry *
+evict (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_CNT; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_CNT;
+
+      if (!e->in_use)
+        return e;
+      if (e->busy)
+        continue;
+      if (e->accessed)
+        e->accessed = false;
+      else
+        {
+          if (e->dirty)
+            write_back (e);
+          e->in_use = false;
+          return e;
+        }
+    }
+  return NULL;
+}
+
+/* Writes E, which must be dirty and not busy, to disk.  The
+   caller must hold cache_lock, which is released during the
+   write.  E stays busy until the write completes, so that its
+   data is not changed under the disk's feet. */
+static void
+write_back (struct cache_entry *e)
+{
+  ASSERT (e->in_use && e->dirty && !e->busy);
+
+  e->busy = true;
+  e->dirty = false;
+  lock_release (&cache_lock);
+  block_write (fs_device, e->sector, e->data);
+  lock_acquire (&cache_lock);
+  e->busy = false;
+  cond_broadcast (&io_done, &cache_lock);
+}
+
+/* Marks E, which must be dirty and not busy, and the dirty,
+   non-busy sectors that directly follow it as busy and clean, and
+   records them in IO as a run to write back.  The caller must
+   hold cache_lock. */
+static void
+claim_dirty_run (struct cache_entry *e, struct cache_io *io)
+{
+  ASSERT (e->in_use && e->dirty && !e->busy);
+
+  for (io->cnt = 0; io->cnt < RUN_MAX; io->cnt++)
+    {
+      struct cache_entry *next = (io->cnt == 0 ? e
+                                  : lookup (e->sector + io->cnt));
+      if (next == NULL || !next->dirty || next->busy)
+        break;
+      next->busy = true;
+      next->dirty = false;
+      io->run[io->cnt] = next;
+      io->buffers[io->cnt] = next->data;
+    }
+  block_request_init (&io->req, true, e->sector, io->buffers, io->cnt,
+                      NULL, NULL);
+}
+
+/* Marks the entries in IO as no longer busy once their I/O has
+   completed.  The caller must hold cache_lock. */
+static void
+finish_run (struct cache_io *io)
+{
+  size_t i;
+
+  for (i = 0; i < io->cnt; i++)
+    io->run[i]->busy = false;
+  cond_broadcast (&io_done, &cache_lock);
+}
+
+/* Writes E, which must be dirty and not busy, to disk together
+   with the dirty, non-busy sectors that directly follow it, in a
+   single request.  The caller must hold cache_lock, which is
+   released during the write. */
+static void
+write_back_run (struct cache_entry *e)
+{
+  struct cache_io io;
+
+  claim_dirty_run (e, &io);
+  lock_release (&cache_lock);
+  block_submit (fs_device, &io.req);
+  block_request_wait (&io.req);
+  lock_acquire (&cache_lock);
+  finish_run (&io);
+}
+
+/* Allocates busy entries for up to CNT sectors starting at
+   SECTOR and records them in IO as a run to load, stopping short
+   at the first sector that is already cached or for which no
+   entry can be freed.  The new entries are left unaccessed.  The
+   caller must hold cache_lock, which may be released and
+   reacquired. */
+static void
+claim_load_run (block_sector_t sector, size_t cnt, struct cache_io *io)
+{
+  ASSERT (cnt <= RUN_MAX);
+
+  for (io->cnt = 0; io->cnt < cnt; io->cnt++)
+    {
+      block_sector_t s = sector + io->cnt;
+      struct cache_entry *e;
+
+      if (lookup (s) != NULL)
+        break;
+      e = evict ();
+
+      /* Evicting may have released the lock, so check again. */
+      if (e == NULL || lookup (s) != NULL)
+        break;
+      e->sector = s;
+      e->in_use = true;
+      e->busy = true;
+      e->dirty = false;
+      e->accessed = false;
+      io->run[io->cnt] = e;
+      io->buffers[io->cnt] = e->data;
+    }
+}
+
+/* Starts loading up to CNT sectors starting at SECTOR into the
+   cache with a single request, stopping short at the first
+   sector that is already cached or for which no entry can be
+   freed.  Does not wait for the read to complete.  The new
+   entries are left unaccessed, so that a sector that is never
+   actually read is the first to be evicted.  The caller must
+   hold cache_lock, which may be released and reacquired. */
+static void
+load_run (block_sector_t sector, size_t cnt)
+{
+  struct cache_io *io;
+
+  /* Read-ahead is only a hint, so give up if memory is short. */
+  io = malloc (sizeof *io);
+  if (io == NULL)
+    return;
+
+  claim_load_run (sector, cnt, io);
+  if (io->cnt == 0)
+    {
+      free (io);
+      return;
+    }
+
+  block_request_init (&io->req, false, sector, io->buffers, io->cnt,
+                      load_done, io);
+  block_submit (fs_device, &io->req);
+}
+
+/* Completion callback for load_run(). */
+static void
+load_done (struct block_request *req UNUSED, void *io_)
+{
+  struct cache_io *io = io_;
+
+  lock_acquire (&cache_lock);
+  finish_run (io);
+  lock_release (&cache_lock);
+  free (io);
+}
+
+/* Read-ahead thread.  Loads queued sectors into the cache,
+   taking runs of consecutive sectors off the queue together. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      block_sector_t sector;
+      size_t cnt;
+
+      while (read_ahead_cnt == 0)
+        cond_wait (&read_ahead_ready, &cache_lock);
+      sector = read_ahead_queue[read_ahead_head];
+      cnt = 0;
+      do
+        {
+          read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_MAX;
+          read_ahead_cnt--;
+          cnt++;
+        }
+      while (read_ahead_cnt > 0 && cnt < RUN_MAX
+             && read_ahead_queue[read_ahead_head] == sector + cnt);
+
+      load_run (sector, cnt);
+    }
+}
+
+/* Write-behind thread.  Flushes the free map and then the cache
+   periodically, so that neither dirty data nor allocations stay
+   in memory indefinitely. */
+static void
+write_behind_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (WRITE_BEHIND_TICKS);
+      free_map_flush ();
+      cache_flush ();
+    }
+}
@@ -1,16 +1,19 @@
 #include "filesys/directory.h"
+#include <hash.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
+    size_t pos;                         /* Current slot for readdir. */
   };
 
 /* A single directory entry. */
@@ -21,12 +24,129 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Directory formats.
+
+   A small directory is just an array of entries, searched
+   linearly.  An entry that is not in use may be reused.
+
+   Once a directory needs more than DIR_LINEAR_MAX entries it is
+   converted to a hashed format.  Its first sector then holds a
+   `struct dir_index' header, and the following sectors are
+   buckets of DIR_BUCKET_ENTRIES entries each.  A name is stored
+   in the bucket its hash selects or, if that bucket is full, in
+   the next one that has room.  A slot that has never been used
+   (all zeros) differs from one whose entry was removed (name
+   still set), and a bucket with a never-used slot has never
+   been full, so a lookup can stop there.  Lookup, add and remove
+   then read only one or a few sectors.  The entries are rehashed
+   when the buckets become 3/4 full, counting removed entries,
+   which lookups must probe past like live ones.  The buckets are
+   doubled if the live entries alone would fill them that far. */
+
+/* Header of a hashed directory. */
+struct dir_index
+  {
+    block_sector_t magic;               /* DIR_INDEX_MAGIC. */
+    uint32_t bucket_cnt;                /* Number of buckets. */
+    uint32_t entry_cnt;                 /* Number of entries in use. */
+    uint32_t removed_cnt;               /* Number of removed entries. */
+  };
+
+/* Identifies a hashed directory.  It occupies the spot of the
+   first entry's `inode_sector' in a linear directory, and is
+   larger than any sector number an IDE disk can have. */
+#define DIR_INDEX_MAGIC 0x44495258
+
+/* Largest number of entries in a linear directory. */
+#define DIR_LINEAR_MAX 50
+
+/* Entries per bucket of a hashed directory. */
+#define DIR_BUCKET_ENTRIES (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* Number of buckets a directory gets when it becomes hashed. */
+#define DIR_MIN_BUCKETS 4
+
+/* True if a hashed directory with BUCKET_CNT buckets is too full
+   to hold ENTRY_CNT entries. */
+#define OVERLOADED(ENTRY_CNT, BUCKET_CNT) \
+        ((ENTRY_CNT) * 4 > (BUCKET_CNT) * DIR_BUCKET_ENTRIES * 3)
+
+/* Name lookup cache.
+
+   Maps a directory's inode sector and a name to the inode sector
+   of the entry by that name, so that repeated lookups of the same
+   path need not search the directory at all.  A cached sector of
+   0 records that the name is absent, which is safe because sector
+   0 holds the free map's inode, never a file's.  The table is
+   direct-mapped: a new entry simply replaces whatever hashed to
+   the same slot.
+
+   dir_add() and dir_remove() update the entry for the name they
+   change.  A lookup that misses searches the directory without
+   holding dentry_lock, so it notes dentry_gen first and only
+   caches its result if no directory changed in the meantime. */
+struct dentry
+  {
+    block_sector_t dir_sector;          /* Directory's inode sector. */
+    block_sector_t inode_sector;        /* Entry's inode sector, or 0. */
+    char name[NAME_MAX + 1];            /* Name; empty if slot unused. */
+  };
+
+#define DENTRY_CNT 256                  /* Number of cache slots. */
+
+static struct dentry dentries[DENTRY_CNT];
+static struct lock dentry_lock;
+static unsigned dentry_gen;             /* Incremented on every change. */
+
+static bool dentry_find (const struct dir *, const char *name,
+                         block_sector_t *sectorp, unsigned *genp);
+static void dentry_store (const struct dir *, const char *name,
+                          block_sector_t, unsigned gen);
+static void dentry_update (const struct dir *, const char *name,
+                           block_sector_t);
+static void dentry_purge (block_sector_t dir_sector);
+
+static bool is_dot (const char *name);
+static bool is_empty (struct inode *);
+static bool read_index (const struct dir *, struct dir_index *);
+static bool read_slot (const struct dir *, const struct dir_index *,
+                       size_t idx, struct dir_entry *, off_t *ofsp);
+static bool index_lookup (const struct dir *, const struct dir_index *,
+                          const char *name, struct dir_entry *,
+                          off_t *ofsp);
+static bool index_insert (struct dir *, struct dir_index *,
+                          const struct dir_entry *);
+static bool build_index (struct dir *, size_t bucket_cnt);
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  lock_init (&dentry_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, whose parent directory is in sector PARENT.  The
+   new directory contains only "." and "..".  Returns true if
+   successful, false on failure.  On failure, nothing but SECTOR
+   itself has been allocated. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, block_sector_t parent, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir *dir;
+  bool success;
+
+  dentry_purge (sector);
+  if (!inode_create (sector, (entry_cnt + 2) * sizeof (struct dir_entry),
+                     true))
+    return false;
+
+  dir = dir_open (inode_open (sector));
+  success = (dir != NULL
+             && dir_add (dir, ".", sector)
+             && dir_add (dir, "..", parent));
+  dir_close (dir);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -92,12 +212,16 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
+  struct dir_index h;
   struct dir_entry e;
   size_t ofs;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (read_index (dir, &h))
+    return index_lookup (dir, &h, name, ep, ofsp);
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -120,14 +244,18 @@ dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
   struct dir_entry e;
+  block_sector_t sector;
+  unsigned gen;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  if (!dentry_find (dir, name, &sector, &gen))
+    {
+      sector = lookup (dir, name, &e, NULL) ? e.inode_sector : 0;
+      dentry_store (dir, name, sector, gen);
+    }
+  *inode = sector != 0 ? inode_open (sector) : NULL;
 
   return *inode != NULL;
 }
@@ -141,7 +269,10 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_index h;
   struct dir_entry e;
+  block_sector_t cached;
+  unsigned gen;
   off_t ofs;
   bool success = false;
 
@@ -153,37 +284,79 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
     return false;
 
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
-    goto done;
+  if (dentry_find (dir, name, &cached, &gen) ? cached != 0
+      : lookup (dir, name, NULL, NULL))
+    return false;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  if (!read_index (dir, &h))
+    {
+      /* Set OFS to offset of free slot.
+         If there are no free slots, then it will be set to the
+         current end-of-file.
+
+         inode_read_at() will only return a short read at end of
+         file.  Otherwise, we'd need to verify that we didn't get
+         a short read due to something intermittent such as low
+         memory. */
+      for (ofs = 0;
+           inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+           ofs += sizeof e)
+        if (!e.in_use)
+          break;
+
+      if (ofs < (off_t) (DIR_LINEAR_MAX * sizeof e))
+        {
+          /* Write slot. */
+          e.in_use = true;
+          strlcpy (e.name, name, sizeof e.name);
+          e.inode_sector = inode_sector;
+          success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+          goto done;
+        }
+
+      /* The directory has outgrown the linear format. */
+      if (!build_index (dir, DIR_MIN_BUCKETS) || !read_index (dir, &h))
+        goto rebuild_failed;
+    }
+  else if (OVERLOADED (h.entry_cnt + h.removed_cnt + 1, h.bucket_cnt))
+    {
+      size_t bucket_cnt = h.bucket_cnt;
+      if (OVERLOADED (h.entry_cnt + 1, bucket_cnt))
+        bucket_cnt *= 2;
+      if (!build_index (dir, bucket_cnt) || !read_index (dir, &h))
+        goto rebuild_failed;
+    }
 
-  /* Write slot. */
+  /* Insert into the hashed directory and count the entry. */
+  memset (&e, 0, sizeof e);
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (index_insert (dir, &h, &e))
+    {
+      h.entry_cnt++;
+      success = inode_write_at (dir->inode, &h, sizeof h, 0) == sizeof h;
+    }
 
  done:
+  if (success)
+    dentry_update (dir, name, inode_sector);
   return success;
+
+ rebuild_failed:
+  /* Entries may have been lost, so forget all of them. */
+  dentry_purge (inode_get_inumber (dir->inode));
+  return false;
 }
 
 /* Removes any entry for NAME in DIR.
-   Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   Returns true if successful, false on failure, which occurs
+   if there is no file with the given NAME, if NAME is "." or
+   "..", or if NAME is a directory that is open or not empty. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
+  struct dir_index h;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
@@ -201,13 +374,26 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
+  /* Only remove a directory that nobody else is using. */
+  if (is_dot (name)
+      || (inode_is_dir (inode)
+          && (inode_open_cnt (inode) > 1 || !is_empty (inode))))
+    goto done;
+
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  if (read_index (dir, &h))
+    {
+      h.entry_cnt--;
+      h.removed_cnt++;
+      inode_write_at (dir->inode, &h, sizeof h, 0);
+    }
 
   /* Remove inode. */
   inode_remove (inode);
+  dentry_update (dir, name, 0);
   success = true;
 
  done:
@@ -221,12 +407,14 @@ dir_remove (struct dir *dir, const char *name)
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
+  struct dir_index h;
+  bool indexed = read_index (dir, &h);
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  while (read_slot (dir, indexed ? &h : NULL, dir->pos, &e, NULL))
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      dir->pos++;
+      if (e.in_use && !is_dot (e.name))
         {
           strlcpy (name, e.name, NAME_MAX + 1);
           return true;
@@ -234,3 +422,297 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
     }
   return false;
 }
+
+/* Returns true if NAME is "." or "..". */
+static bool
+is_dot (const char *name)
+{
+  return (name[0] == '.'
+          && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')));
+}
+
+/* Returns true if directory INODE has no entries besides "." and
+   "..". */
+static bool
+is_empty (struct inode *inode)
+{
+  struct dir dir;
+  char name[NAME_MAX + 1];
+
+  dir.inode = inode;
+  dir.pos = 0;
+  return !dir_readdir (&dir, name);
+}
+
+/* Returns the name cache slot for NAME in directory DIR_SECTOR. */
+static struct dentry *
+dentry_slot (block_sector_t dir_sector, const char *name)
+{
+  unsigned hash = hash_string (name) ^ hash_int (dir_sector);
+  return &dentries[hash % DENTRY_CNT];
+}
+
+/* Looks up NAME in DIR in the name cache.  On a hit, stores the
+   entry's inode sector, or 0 if NAME is known to be absent, into
+   *SECTORP and returns true.  On a miss, stores the generation to
+   pass to dentry_store() into *GENP and returns false. */
+static bool
+dentry_find (const struct dir *dir, const char *name,
+             block_sector_t *sectorp, unsigned *genp)
+{
+  block_sector_t dir_sector = inode_get_inumber (dir->inode);
+  struct dentry *d = dentry_slot (dir_sector, name);
+  bool hit;
+
+  lock_acquire (&dentry_lock);
+  hit = (*name != '\0' && d->dir_sector == dir_sector
+         && !strcmp (d->name, name));
+  if (hit)
+    *sectorp = d->inode_sector;
+  *genp = dentry_gen;
+  lock_release (&dentry_lock);
+
+  return hit;
+}
+
+/* Caches SECTOR, or 0 for absent, as the entry for NAME in DIR,
+   unless some directory has changed since dentry_find() returned
+   GEN. */
+static void
+dentry_store (const struct dir *dir, const char *name,
+              block_sector_t sector, unsigned gen)
+{
+  block_sector_t dir_sector = inode_get_inumber (dir->inode);
+  struct dentry *d;
+
+  if (*name == '\0' || strlen (name) > NAME_MAX)
+    return;
+
+  d = dentry_slot (dir_sector, name);
+  lock_acquire (&dentry_lock);
+  if (gen == dentry_gen)
+    {
+      d->dir_sector = dir_sector;
+      d->inode_sector = sector;
+      strlcpy (d->name, name, sizeof d->name);
+    }
+  lock_release (&dentry_lock);
+}
+
+/* Records that NAME in DIR now refers to SECTOR, or to nothing if
+   SECTOR is 0. */
+static void
+dentry_update (const struct dir *dir, const char *name,
+               block_sector_t sector)
+{
+  block_sector_t dir_sector = inode_get_inumber (dir->inode);
+  struct dentry *d = dentry_slot (dir_sector, name);
+
+  lock_acquire (&dentry_lock);
+  dentry_gen++;
+  d->dir_sector = dir_sector;
+  d->inode_sector = sector;
+  strlcpy (d->name, name, sizeof d->name);
+  lock_release (&dentry_lock);
+}
+
+/* Drops every cached entry for directory DIR_SECTOR. */
+static void
+dentry_purge (block_sector_t dir_sector)
+{
+  size_t i;
+
+  lock_acquire (&dentry_lock);
+  dentry_gen++;
+  for (i = 0; i < DENTRY_CNT; i++)
+    if (dentries[i].dir_sector == dir_sector)
+      dentries[i].name[0] = '\0';
+  lock_release (&dentry_lock);
+}
+
+/* Reads the header of DIR into *H and returns true if DIR is
+   hashed.  Returns false if DIR is linear. */
+static bool
+read_index (const struct dir *dir, struct dir_index *h)
+{
+  return (inode_read_at (dir->inode, h, sizeof *h, 0) == sizeof *h
+          && h->magic == DIR_INDEX_MAGIC);
+}
+
+/* Reads slot IDX of DIR into *E and, if OFSP is non-null, stores
+   its byte offset into *OFSP.  H is DIR's header if DIR is
+   hashed, otherwise a null pointer.  Returns false if there is
+   no slot IDX.  Slots of a hashed directory that lie beyond the
+   end of its file read as never used. */
+static bool
+read_slot (const struct dir *dir, const struct dir_index *h, size_t idx,
+           struct dir_entry *e, off_t *ofsp)
+{
+  off_t ofs;
+
+  if (h == NULL)
+    {
+      ofs = idx * sizeof *e;
+      if (ofsp != NULL)
+        *ofsp = ofs;
+      return inode_read_at (dir->inode, e, sizeof *e, ofs) == sizeof *e;
+    }
+
+  if (idx >= h->bucket_cnt * DIR_BUCKET_ENTRIES)
+    return false;
+  ofs = ((1 + idx / DIR_BUCKET_ENTRIES) * BLOCK_SECTOR_SIZE
+         + idx % DIR_BUCKET_ENTRIES * sizeof *e);
+  if (ofsp != NULL)
+    *ofsp = ofs;
+  if (inode_read_at (dir->inode, e, sizeof *e, ofs) != sizeof *e)
+    memset (e, 0, sizeof *e);
+  return true;
+}
+
+/* Searches hashed directory DIR, whose header is H, for NAME, as
+   lookup() does. */
+static bool
+index_lookup (const struct dir *dir, const struct dir_index *h,
+              const char *name, struct dir_entry *ep, off_t *ofsp)
+{
+  size_t bucket = hash_string (name) % h->bucket_cnt;
+  size_t probes;
+
+  for (probes = 0; probes < h->bucket_cnt; probes++)
+    {
+      bool never_full = false;
+      size_t slot;
+
+      for (slot = 0; slot < DIR_BUCKET_ENTRIES; slot++)
+        {
+          struct dir_entry e;
+          off_t ofs;
+
+          read_slot (dir, h, bucket * DIR_BUCKET_ENTRIES + slot, &e, &ofs);
+          if (e.in_use && !strcmp (name, e.name))
+            {
+              if (ep != NULL)
+                *ep = e;
+              if (ofsp != NULL)
+                *ofsp = ofs;
+              return true;
+            }
+          if (!e.in_use && e.name[0] == '\0')
+            never_full = true;
+        }
+      if (never_full)
+        break;
+      bucket = (bucket + 1) % h->bucket_cnt;
+    }
+  return false;
+}
+
+/* Stores E into the first free slot for its name in hashed
+   directory DIR, whose header is H.  The name must not already
+   be present.  Returns true if successful, false on failure.
+   Decrements H's count of removed entries if E takes the slot
+   of one, but does not write H back. */
+static bool
+index_insert (struct dir *dir, struct dir_index *h,
+              const struct dir_entry *e)
+{
+  size_t bucket = hash_string (e->name) % h->bucket_cnt;
+  size_t probes;
+
+  for (probes = 0; probes < h->bucket_cnt; probes++)
+    {
+      size_t slot;
+
+      for (slot = 0; slot < DIR_BUCKET_ENTRIES; slot++)
+        {
+          struct dir_entry old;
+          off_t ofs;
+
+          read_slot (dir, h, bucket * DIR_BUCKET_ENTRIES + slot, &old, &ofs);
+          if (!old.in_use)
+            {
+              if (old.name[0] != '\0')
+                h->removed_cnt--;
+              return inode_write_at (dir->inode, e, sizeof *e, ofs) == sizeof *e;
+            }
+        }
+      bucket = (bucket + 1) % h->bucket_cnt;
+    }
+  return false;
+}
+
+/* Rewrites DIR, linear or hashed, as a hashed directory with at
+   least BUCKET_CNT buckets.  Returns true if successful, false
+   if memory or disk space ran out, in which case DIR still holds
+   all of its entries. */
+static bool
+build_index (struct dir *dir, size_t bucket_cnt)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  struct dir_index old, h;
+  const struct dir_index *oldp;
+  struct dir_entry e, *entries;
+  char *sector;
+  size_t entry_cnt = 0;
+  size_t sector_cnt, i;
+  bool success = true;
+
+  /* Gather the entries in use. */
+  oldp = read_index (dir, &old) ? &old : NULL;
+  for (i = 0; read_slot (dir, oldp, i, &e, NULL); i++)
+    if (e.in_use)
+      entry_cnt++;
+  entries = malloc (entry_cnt * sizeof *entries + 1);
+  sector = malloc (BLOCK_SECTOR_SIZE);
+  if (entries == NULL || sector == NULL)
+    {
+      free (entries);
+      free (sector);
+      return false;
+    }
+  entry_cnt = 0;
+  for (i = 0; read_slot (dir, oldp, i, &e, NULL); i++)
+    if (e.in_use)
+      entries[entry_cnt++] = e;
+
+  /* Allocate every sector of the new format before changing any
+     of the old one, by writing each sector back unchanged, so
+     that running out of disk space cannot lose entries.  Sectors
+     beyond end of file and holes read as zeros. */
+  while (OVERLOADED (entry_cnt, bucket_cnt))
+    bucket_cnt *= 2;
+  sector_cnt = DIV_ROUND_UP (inode_length (dir->inode), BLOCK_SECTOR_SIZE);
+  for (i = 0; i <= bucket_cnt && success; i++)
+    {
+      memset (sector, 0, BLOCK_SECTOR_SIZE);
+      inode_read_at (dir->inode, sector, BLOCK_SECTOR_SIZE,
+                     i * BLOCK_SECTOR_SIZE);
+      success = inode_write_at (dir->inode, sector, BLOCK_SECTOR_SIZE,
+                                i * BLOCK_SECTOR_SIZE) == BLOCK_SECTOR_SIZE;
+    }
+  free (sector);
+  if (!success)
+    {
+      free (entries);
+      return false;
+    }
+
+  /* Clear the buckets that overlap what was already in the
+     file.  The rest were just written as zeros. */
+  for (i = 1; i < sector_cnt && i <= bucket_cnt && success; i++)
+    success = inode_write_at (dir->inode, zeros, BLOCK_SECTOR_SIZE,
+                              i * BLOCK_SECTOR_SIZE) == BLOCK_SECTOR_SIZE;
+
+  /* Write the header, then put every entry back. */
+  h.magic = DIR_INDEX_MAGIC;
+  h.bucket_cnt = bucket_cnt;
+  h.entry_cnt = entry_cnt;
+  h.removed_cnt = 0;
+  if (success)
+    success = inode_write_at (dir->inode, &h, sizeof h, 0) == sizeof h;
+  for (i = 0; i < entry_cnt && success; i++)
+    success = index_insert (dir, &h, &entries[i]);
+
+  free (entries);
+  return success;
+}
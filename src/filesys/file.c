@@ -3,12 +3,17 @@
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Number of bytes to read ahead of a file that is being read
+   sequentially. */
+#define READ_AHEAD_BYTES (8 * BLOCK_SECTOR_SIZE)
+
 /* An open file. */
 struct file
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t read_end;             /* Where the last file_read() ended. */
   };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -23,6 +28,7 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->read_end = 0;
       return file;
     }
   else
@@ -64,12 +70,19 @@ file_get_inode (struct file *file)
    starting at the file's current position.
    Returns the number of bytes actually read,
    which may be less than SIZE if end of file is reached.
-   Advances FILE's position by the number of bytes read. */
+   Advances FILE's position by the number of bytes read.
+   A read that starts where the previous one ended is taken as
+   a sign of sequential access, so the data following it is read
+   ahead in the background. */
 off_t
 file_read (struct file *file, void *buffer, off_t size)
 {
+  bool sequential = file->pos == file->read_end;
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file->read_end = file->pos;
+  if (sequential && bytes_read > 0)
+    inode_read_ahead (file->inode, file->pos, READ_AHEAD_BYTES);
   return bytes_read;
 }
 
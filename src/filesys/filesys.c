@@ -2,14 +2,17 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+static struct dir *resolve_path (const char *path, char base[NAME_MAX + 1]);
 static void do_format (void);
 
 /* Initializes the file system module.
@@ -21,7 +24,9 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  dir_init ();
   free_map_init ();
 
   if (format)
@@ -35,7 +40,9 @@ filesys_init (bool format)
 void
 filesys_done (void)
 {
+  inode_done ();
   free_map_close ();
+  cache_done ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -46,11 +53,46 @@ bool
 filesys_create (const char *name, off_t initial_size)
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
+  char base[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, base);
   bool success = (dir != NULL
                   && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+                  && inode_create (inode_sector, initial_size, false)
+                  && dir_add (dir, base, inode_sector));
+  if (!success && inode_sector != 0)
+    free_map_release (inode_sector, 1);
+  dir_close (dir);
+
+  return success;
+}
+
+/* Creates a directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  block_sector_t inode_sector = 0;
+  char base[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, base);
+  bool success = false;
+
+  if (dir != NULL
+      && free_map_allocate (1, &inode_sector)
+      && dir_create (inode_sector,
+                     inode_get_inumber (dir_get_inode (dir)), 0))
+    {
+      success = dir_add (dir, base, inode_sector);
+      if (!success)
+        {
+          /* Removing the new directory frees its sectors. */
+          struct inode *inode = inode_open (inode_sector);
+          inode_remove (inode);
+          inode_close (inode);
+          inode_sector = 0;
+        }
+    }
   if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
   dir_close (dir);
@@ -66,11 +108,12 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  char base[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, base);
   struct inode *inode = NULL;
 
   if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+    dir_lookup (dir, base, &inode);
   dir_close (dir);
 
   return file_open (inode);
@@ -83,20 +126,140 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name)
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char base[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, base);
+  bool success = dir != NULL && dir_remove (dir, base);
   dir_close (dir);
 
   return success;
 }
-
+
+/* Makes the directory named NAME the running thread's current
+   directory.  Returns true if successful, false on failure. */
+bool
+filesys_chdir (const char *name)
+{
+  struct thread *t = thread_current ();
+  char base[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, base);
+  struct inode *inode = NULL;
+
+  if (dir != NULL)
+    dir_lookup (dir, base, &inode);
+  dir_close (dir);
+
+  if (inode == NULL || !inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return false;
+    }
+  dir = dir_open (inode);
+  if (dir == NULL)
+    return false;
+
+  dir_close (t->cwd);
+  t->cwd = dir;
+  return true;
+}
+
+/* Extracts a file name part from *SRCP into PART, and updates
+   *SRCP so that the next call will return the next file name
+   part.  Returns 1 if successful, 0 at end of string, -1 for a
+   too-long file name part. */
+static int
+get_next_part (char part[NAME_MAX + 1], const char **srcp)
+{
+  const char *src = *srcp;
+  char *dst = part;
+
+  /* Skip leading slashes.  If it's all slashes, we're done. */
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  /* Copy up to NAME_MAX character from SRC to DST.  Add null
+     terminator. */
+  while (*src != '/' && *src != '\0')
+    {
+      if (dst < part + NAME_MAX)
+        *dst++ = *src;
+      else
+        return -1;
+      src++;
+    }
+  *dst = '\0';
+
+  /* Advance source pointer. */
+  *srcp = src;
+  return 1;
+}
+
+/* Walks PATH, which is absolute or relative to the running
+   thread's current directory, up to its last component.  Returns
+   the directory that should contain that component, which the
+   caller must close, and copies the component into BASE.  If
+   PATH names the root directory, BASE is ".".  Returns a null
+   pointer if PATH is empty, if a component is too long, or if a
+   directory along the way does not exist.
+
+   Only one directory is kept open at a time: each step opens the
+   next directory and closes the one it was found in. */
+static struct dir *
+resolve_path (const char *path, char base[NAME_MAX + 1])
+{
+  struct dir *cwd = thread_current ()->cwd;
+  struct dir *dir;
+  char next[NAME_MAX + 1];
+  int result;
+
+  if (*path == '\0')
+    return NULL;
+  dir = *path == '/' || cwd == NULL ? dir_open_root () : dir_reopen (cwd);
+  if (dir == NULL)
+    return NULL;
+
+  result = get_next_part (base, &path);
+  if (result == 0)
+    {
+      strlcpy (base, ".", NAME_MAX + 1);
+      return dir;
+    }
+  while (result > 0)
+    {
+      struct inode *inode;
+
+      result = get_next_part (next, &path);
+      if (result == 0)
+        return dir;
+      if (result < 0)
+        break;
+
+      /* BASE names a directory to descend into. */
+      if (!dir_lookup (dir, base, &inode))
+        break;
+      dir_close (dir);
+      if (!inode_is_dir (inode))
+        {
+          inode_close (inode);
+          return NULL;
+        }
+      dir = dir_open (inode);
+      if (dir == NULL)
+        return NULL;
+      strlcpy (base, next, NAME_MAX + 1);
+    }
+  dir_close (dir);
+  return NULL;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
@@ -1,13 +1,34 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Changes to the free map are not written to disk right away.
+   Instead, each sector of the free map file that is out of date
+   is marked in this bitmap, and free_map_flush() writes just
+   those sectors. */
+static struct bitmap *dirty_map;
+
+/* The write-behind thread flushes the free map concurrently with
+   its other users.  FREE_MAP_LOCK protects FREE_MAP and
+   DIRTY_MAP.  FLUSH_LOCK serializes flushes and protects
+   FREE_MAP_FILE; it is never acquired with FREE_MAP_LOCK held,
+   and it is held across disk I/O while FREE_MAP_LOCK is not. */
+static struct lock free_map_lock;
+static struct lock flush_lock;
+
+/* Number of free map bits in one sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+static void mark_dirty (block_sector_t, size_t cnt);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
@@ -15,6 +36,12 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty_map = bitmap_create (DIV_ROUND_UP (block_size (fs_device),
+                                           BITS_PER_SECTOR));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  lock_init (&free_map_lock);
+  lock_init (&flush_lock);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
 }
@@ -22,31 +49,99 @@ free_map_init (void)
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      mark_dirty (sector, cnt);
+      *sectorp = sector;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates the CNT consecutive sectors starting at SECTOR, if
+   they are all free.
+   Returns true if successful, false if any of them was in use or
+   beyond the end of the device. */
+bool
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  if (sector < bitmap_size (free_map)
+      && cnt <= bitmap_size (free_map) - sector
+      && !bitmap_any (free_map, sector, cnt))
+    {
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      mark_dirty (sector, cnt);
+      success = true;
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the parts of the free map that changed since the last
+   flush to the free map file.  A sector's dirty bit is cleared
+   before it is written, so that a change made during the write
+   marks it dirty again for the next flush. */
+void
+free_map_flush (void)
+{
+  size_t i;
+
+  lock_acquire (&flush_lock);
+  if (free_map_file != NULL)
+    for (i = 0; i < bitmap_size (dirty_map); i++)
+      {
+        size_t start = i * BITS_PER_SECTOR;
+        size_t cnt = bitmap_size (free_map) - start;
+        bool dirty;
+
+        if (cnt > BITS_PER_SECTOR)
+          cnt = BITS_PER_SECTOR;
+        lock_acquire (&free_map_lock);
+        dirty = bitmap_test (dirty_map, i);
+        bitmap_reset (dirty_map, i);
+        lock_release (&free_map_lock);
+
+        if (dirty && !bitmap_write_bits (free_map, free_map_file, start, cnt))
+          {
+            lock_acquire (&free_map_lock);
+            bitmap_mark (dirty_map, i);
+            lock_release (&free_map_lock);
+          }
+      }
+  lock_release (&flush_lock);
+}
+
+/* Notes that the free map bits for the CNT sectors starting at
+   SECTOR have changed.  The caller must hold free_map_lock. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  if (cnt > 0)
+    bitmap_set_multiple (dirty_map, sector / BITS_PER_SECTOR,
+                         (sector + cnt - 1) / BITS_PER_SECTOR
+                         - sector / BITS_PER_SECTOR + 1, true);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -60,11 +155,28 @@ free_map_open (void)
     PANIC ("can't read free map");
 }
 
-/* Writes the free map to disk and closes the free map file. */
+/* Writes the free map to disk and closes the free map file.
+   Closing the file gives back any sectors reserved for its
+   growth, which changes the free map, so the file is closed
+   first and reopened for the last flush.  Writing the map
+   rewrites sectors the file already has, so the reopened file
+   reserves nothing. */
 void
 free_map_close (void) 
 {
+  lock_acquire (&flush_lock);
+  file_close (free_map_file);
+  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (free_map_file == NULL)
+    PANIC ("can't open free map");
+  lock_release (&flush_lock);
+
+  free_map_flush ();
+
+  lock_acquire (&flush_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&flush_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -73,7 +185,7 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
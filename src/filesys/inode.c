@@ -1,25 +1,87 @@
 #include "filesys/inode.h"
 #include <list.h>
 #include <debug.h>
+#include <hash.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of LENGTH consecutive sectors starting at START. */
+struct extent
+  {
+    block_sector_t start;               /* First sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+/* Number of extents stored in an inode and in an extent block. */
+#define DIRECT_EXTENT_CNT 61
+#define BLOCK_EXTENT_CNT 63
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A file's data is a sequence of extents.  The first
+   DIRECT_EXTENT_CNT are stored in the inode itself and the rest
+   in a chain of extent blocks.  A sector number of 0 means "none":
+   sector 0 always holds the free map's inode, so it can never be
+   part of another file.
+
+   An extent that starts at sector 0 is a hole: its data has never
+   been written, reads back as zeros, and takes no disk space.
+   Creating or extending a file only adds a hole, and sectors are
+   allocated when the hole is first written.  So nothing is ever
+   written to disk just to zero it, and allocation is delayed
+   until the data's size and neighbors are known. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    struct extent extents[DIRECT_EXTENT_CNT]; /* First extents. */
+    block_sector_t extent_block;        /* First extent block. */
+    uint32_t extent_cnt;                /* Number of extents. */
+    uint32_t sector_cnt;                /* Sectors in all extents. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t is_dir;                    /* Nonzero for a directory. */
+  };
+
+/* On-disk extent block.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    struct extent extents[BLOCK_EXTENT_CNT]; /* Extents. */
+    block_sector_t next;                /* Next extent block. */
+    uint32_t unused;                    /* Not used. */
+  };
+
+/* Sectors set aside just past the end of a file, so that it can
+   grow in place even while other files are growing too.  They
+   are marked used in the free map, but not yet part of the
+   file. */
+struct reservation
+  {
+    block_sector_t start;               /* First reserved sector. */
+    size_t cnt;                         /* Number of reserved sectors. */
   };
 
+/* Number of extra sectors reserved when a growing file needs
+   new space. */
+#define RESERVE_SECTORS 16
+
+/* A sector's worth of zeros, for initializing new sectors. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -28,49 +90,117 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* Where the last lookup in an inode's extent list ended: extent
+   EXTENT starts at data sector BASE of the file.  Sequential
+   access looks up the same extent or the next one each time, so
+   starting from here spares byte_to_sector() a walk over the
+   whole extent list, and the extent blocks, for every sector. */
+struct extent_hint
+  {
+    size_t extent;                      /* Extent index. */
+    size_t base;                        /* Its first data sector. */
+  };
+
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct list_elem elem;              /* Element in inode bucket. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    unsigned version;                   /* Incremented by each write. */
+    struct reservation reserve;         /* Space set aside for growth. */
+    struct extent_hint hint;            /* Last extent looked up.
+                                           Accessed with interrupts
+                                           off, to keep it whole. */
     struct inode_disk data;             /* Inode content. */
   };
 
+static block_sector_t index_to_sector (const struct inode_disk *, size_t,
+                                       struct extent_hint *);
+static void reset_hint (struct inode *);
+static bool extend (struct inode_disk *, off_t length);
+static bool fill_hole (struct inode_disk *, off_t offset, off_t size,
+                       struct reservation *);
+static void release_sectors (struct inode_disk *);
+static void release_reservation (struct reservation *);
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+byte_to_sector (struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return index_to_sector (&inode->data, pos / BLOCK_SECTOR_SIZE,
+                            &inode->hint);
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Hash table of open inodes, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'.  Each
+   bucket has its own lock, which protects its list and the
+   `open_cnt' of the inodes in it, so opens and closes of
+   unrelated inodes do not contend. */
+#define INODE_BUCKET_CNT 64
+struct inode_bucket
+  {
+    struct list inodes;                 /* Open inodes. */
+    struct lock lock;                   /* Protects this bucket. */
+  };
+static struct inode_bucket open_inodes[INODE_BUCKET_CNT];
+
+/* Returns the bucket for the inode in SECTOR. */
+static struct inode_bucket *
+sector_bucket (block_sector_t sector)
+{
+  return &open_inodes[hash_int (sector) % INODE_BUCKET_CNT];
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  size_t i;
+
+  for (i = 0; i < INODE_BUCKET_CNT; i++)
+    {
+      list_init (&open_inodes[i].inodes);
+      lock_init (&open_inodes[i].lock);
+    }
+}
+
+/* Shuts down the inode module, giving back the space reserved
+   for the growth of inodes that are still open. */
+void
+inode_done (void)
+{
+  size_t i;
+
+  for (i = 0; i < INODE_BUCKET_CNT; i++)
+    {
+      struct inode_bucket *b = &open_inodes[i];
+      struct list_elem *e;
+
+      lock_acquire (&b->lock);
+      for (e = list_begin (&b->inodes); e != list_end (&b->inodes);
+           e = list_next (e))
+        release_reservation (&list_entry (e, struct inode, elem)->reserve);
+      lock_release (&b->lock);
+    }
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  IS_DIR marks the inode as a directory.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -80,26 +210,21 @@ inode_create (block_sector_t sector, off_t length)
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_block) == BLOCK_SECTOR_SIZE);
 
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start))
+      disk_inode->is_dir = is_dir;
+      if (extend (disk_inode, length))
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0)
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-
-              for (i = 0; i < sectors; i++)
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          disk_inode->length = length;
+          cache_write (sector, disk_inode);
           success = true;
         }
+      else
+        release_sectors (disk_inode);
       free (disk_inode);
     }
   return success;
@@ -111,17 +236,21 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
+  struct inode_bucket *b = sector_bucket (sector);
   struct list_elem *e;
   struct inode *inode;
 
+  lock_acquire (&b->lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
+  for (e = list_begin (&b->inodes); e != list_end (&b->inodes);
        e = list_next (e))
     {
       inode = list_entry (e, struct inode, elem);
       if (inode->sector == sector)
         {
-          inode_reopen (inode);
+          inode->open_cnt++;
+          lock_release (&b->lock);
           return inode;
         }
     }
@@ -129,15 +258,24 @@ inode_open (block_sector_t sector)
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&b->lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The bucket stays locked until the inode is read
+     in, so that a concurrent open of the same sector waits for it
+     instead of seeing a half-initialized inode. */
+  list_push_front (&b->inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
+  inode->version = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->reserve.cnt = 0;
+  inode->hint.extent = inode->hint.base = 0;
+  cache_read (inode->sector, &inode->data);
+  lock_release (&b->lock);
   return inode;
 }
 
@@ -146,7 +284,13 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      struct inode_bucket *b = sector_bucket (inode->sector);
+
+      lock_acquire (&b->lock);
+      inode->open_cnt++;
+      lock_release (&b->lock);
+    }
   return inode;
 }
 
@@ -163,27 +307,57 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode)
 {
+  struct inode_bucket *b;
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
+
+  b = sector_bucket (inode->sector);
+  lock_acquire (&b->lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    list_remove (&inode->elem);
+  lock_release (&b->lock);
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      release_reservation (&inode->reserve);
 
       /* Deallocate blocks if removed. */
       if (inode->removed)
         {
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length));
+          release_sectors (&inode->data);
         }
 
       free (inode);
     }
 }
 
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
+/* Returns the number of openers of INODE. */
+int
+inode_open_cnt (const struct inode *inode)
+{
+  struct inode_bucket *b = sector_bucket (inode->sector);
+  int open_cnt;
+
+  lock_acquire (&b->lock);
+  open_cnt = inode->open_cnt;
+  lock_release (&b->lock);
+
+  return open_cnt;
+}
+
 /* Marks INODE to be deleted when it is closed by the last caller who
    has it open. */
 void
@@ -191,6 +365,16 @@ inode_remove (struct inode *inode)
 {
   ASSERT (inode != NULL);
   inode->removed = true;
+#ifdef VM
+  page_cache_remove (inode);
+#endif
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -201,7 +385,6 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0)
     {
@@ -219,23 +402,43 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx == 0)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* Holes read as zeros. */
+          memset (buffer + bytes_read, 0, chunk_size);
         }
-      else
+#ifdef VM
+      else if (page_cache_read (inode, buffer + bytes_read, offset,
+                                chunk_size))
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL)
+          /* Copied from a page that is resident in the page
+             cache. */
+        }
+#endif
+      else if (chunk_size == BLOCK_SECTOR_SIZE)
+        {
+          /* Whole sectors that are also consecutive on disk, up to
+             a page's worth, are copied out of the cache together,
+             and any that are missing are read with one request.
+             A page-aligned read of a page lands in the caller's
+             page with a single copy per sector. */
+          size_t cnt = 1;
+          while (cnt < PGSIZE / BLOCK_SECTOR_SIZE
+                 && size - chunk_size >= BLOCK_SECTOR_SIZE
+                 && inode_left - chunk_size >= BLOCK_SECTOR_SIZE
+                 && (byte_to_sector (inode, offset + chunk_size)
+                     == sector_idx + cnt))
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              cnt++;
+              chunk_size += BLOCK_SECTOR_SIZE;
             }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          cache_read_multi (sector_idx, buffer + bytes_read, cnt);
+        }
+      else
+        {
+          /* Copy straight out of the cached sector. */
+          cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                         chunk_size);
         }
 
       /* Advance. */
@@ -243,26 +446,52 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
+/* Asks for the sectors that hold the SIZE bytes of INODE
+   starting at OFFSET to be read into the buffer cache in the
+   background, in the expectation that they will be read soon. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != 0)
+        cache_read_ahead (sector);
+    }
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if an error occurs.  A write past end of file
+   extends the inode; any gap between the old end of file and
+   OFFSET reads back as zeros.  If the disk fills up, the write
+   stops at the old end of file. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  off_t old_length = inode_length (inode);
+  bool dirty = false;
   if (inode->deny_write_cnt)
     return 0;
 
+  if (offset + size > old_length && extend (&inode->data, offset + size))
+    {
+      inode->data.length = offset + size;
+      dirty = true;
+    }
+
   while (size > 0)
     {
       /* Sector to write, starting byte offset within sector. */
@@ -279,38 +508,40 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx == 0)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          /* Allocate sectors for the part of a hole that this
+             write covers. */
+          if (!fill_hole (&inode->data, offset, size, &inode->reserve))
+            break;
+          reset_hint (inode);
+          sector_idx = byte_to_sector (inode, offset);
+          dirty = true;
         }
-      else
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left)
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* Copy straight into the cached sector.  The cache reads
+         the sector in first only if the chunk does not cover it
+         entirely. */
+      cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                      chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* If the disk filled up, don't leave the file longer than what
+     was written. */
+  if (inode->data.length > old_length && inode->data.length > offset)
+    inode->data.length = old_length > offset ? old_length : offset;
+  if (dirty)
+    cache_write (inode->sector, &inode->data);
+  if (bytes_written > 0)
+    inode->version++;
+#ifdef VM
+  page_cache_write (inode, buffer, offset - bytes_written, bytes_written);
+#endif
 
   return bytes_written;
 }
@@ -335,9 +566,376 @@ inode_allow_write (struct inode *inode)
   inode->deny_write_cnt--;
 }
 
+/* Returns a number that changes whenever INODE is written, so
+   that data derived from its contents can be checked for
+   staleness while INODE stays open. */
+unsigned
+inode_version (const struct inode *inode)
+{
+  return inode->version;
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* If *SECTORP is 0, allocates a sector, fills it with zeros, and
+   stores its number into *SECTORP.  Returns false if the disk is
+   full, true otherwise. */
+static bool
+allocate_zeroed (block_sector_t *sectorp)
+{
+  if (*sectorp != 0)
+    return true;
+  if (!free_map_allocate (1, sectorp))
+    return false;
+  cache_write (*sectorp, zeros);
+  return true;
+}
+
+/* Finds the extent block that holds extent IDX of DISK_INODE,
+   which must be at least DIRECT_EXTENT_CNT, and stores its
+   sector number into *BLOCKP.  If CREATE is true, missing extent
+   blocks are allocated on the way.  Returns false if a block is
+   missing and could not be allocated. */
+static bool
+locate_extent_block (struct inode_disk *disk_inode, size_t idx, bool create,
+                     block_sector_t *blockp)
+{
+  block_sector_t block = disk_inode->extent_block;
+  size_t hops = (idx - DIRECT_EXTENT_CNT) / BLOCK_EXTENT_CNT;
+
+  ASSERT (idx >= DIRECT_EXTENT_CNT);
+
+  if (block == 0)
+    {
+      if (!create || !allocate_zeroed (&block))
+        return false;
+      disk_inode->extent_block = block;
+    }
+  for (; hops > 0; hops--)
+    {
+      block_sector_t next;
+
+      cache_read_at (block, &next, offsetof (struct extent_block, next),
+                     sizeof next);
+      if (next == 0)
+        {
+          if (!create || !allocate_zeroed (&next))
+            return false;
+          cache_write_at (block, &next, offsetof (struct extent_block, next),
+                          sizeof next);
+        }
+      block = next;
+    }
+  *blockp = block;
+  return true;
+}
+
+/* Returns the byte offset of extent IDX, which must be at least
+   DIRECT_EXTENT_CNT, within its extent block. */
+static int
+extent_ofs (size_t idx)
+{
+  return ((idx - DIRECT_EXTENT_CNT) % BLOCK_EXTENT_CNT
+          * sizeof (struct extent));
+}
+
+/* Returns extent IDX of DISK_INODE. */
+static struct extent
+get_extent (const struct inode_disk *disk_inode, size_t idx)
+{
+  struct extent e;
+  block_sector_t block;
+
+  ASSERT (idx < disk_inode->extent_cnt);
+  if (idx < DIRECT_EXTENT_CNT)
+    return disk_inode->extents[idx];
+  if (!locate_extent_block ((struct inode_disk *) disk_inode, idx, false,
+                            &block))
+    NOT_REACHED ();
+  cache_read_at (block, &e, extent_ofs (idx), sizeof e);
+  return e;
+}
+
+/* Stores E as extent IDX of DISK_INODE, allocating an extent
+   block if necessary.  Returns false if that fails. */
+static bool
+put_extent (struct inode_disk *disk_inode, size_t idx, struct extent e)
+{
+  block_sector_t block;
+
+  if (idx < DIRECT_EXTENT_CNT)
+    disk_inode->extents[idx] = e;
+  else if (locate_extent_block (disk_inode, idx, true, &block))
+    cache_write_at (block, &e, extent_ofs (idx), sizeof e);
+  else
+    return false;
+  return true;
+}
+
+/* Returns the device sector that holds data sector IDX of the
+   file described by DISK_INODE, or 0 if IDX is in a hole.  The
+   search starts at HINT if that is not past IDX, and HINT is
+   updated to the extent that holds IDX. */
+static block_sector_t
+index_to_sector (const struct inode_disk *disk_inode, size_t idx,
+                 struct extent_hint *hint)
+{
+  enum intr_level old_level;
+  struct extent_hint h;
+
+  old_level = intr_disable ();
+  h = *hint;
+  intr_set_level (old_level);
+  if (h.base > idx || h.extent >= disk_inode->extent_cnt)
+    h.extent = h.base = 0;
+
+  for (; h.extent < disk_inode->extent_cnt; h.extent++)
+    {
+      struct extent e = get_extent (disk_inode, h.extent);
+      if (idx < h.base + e.length)
+        {
+          old_level = intr_disable ();
+          *hint = h;
+          intr_set_level (old_level);
+          return e.start != 0 ? e.start + (idx - h.base) : 0;
+        }
+      h.base += e.length;
+    }
+  NOT_REACHED ();
+}
+
+/* Forgets INODE's extent hint, after its extents have been split
+   or moved. */
+static void
+reset_hint (struct inode *inode)
+{
+  enum intr_level old_level = intr_disable ();
+  inode->hint.extent = inode->hint.base = 0;
+  intr_set_level (old_level);
+}
+
+/* Adds the CNT sectors starting at START, or a CNT-sector hole if
+   START is 0, to the end of DISK_INODE's data.  They are merged
+   into the last extent if they directly follow it.  Returns false
+   if a new extent block was needed but could not be allocated. */
+static bool
+append_extent (struct inode_disk *disk_inode, block_sector_t start,
+               size_t cnt)
+{
+  size_t last = disk_inode->extent_cnt - 1;
+  struct extent e;
+
+  if (disk_inode->extent_cnt > 0)
+    {
+      e = get_extent (disk_inode, last);
+      if (e.start == 0 ? start == 0 : e.start + e.length == start)
+        {
+          e.length += cnt;
+          put_extent (disk_inode, last, e);
+          disk_inode->sector_cnt += cnt;
+          return true;
+        }
+    }
+
+  e.start = start;
+  e.length = cnt;
+  if (!put_extent (disk_inode, disk_inode->extent_cnt, e))
+    return false;
+  disk_inode->extent_cnt++;
+  disk_inode->sector_cnt += cnt;
+  return true;
+}
+
+/* Obtains up to WANT free sectors, as one run, preferably
+   starting at GOAL if it is nonzero.  Stores the first sector
+   into *STARTP and the number obtained into *CNTP.
+
+   Sectors come from RESERVE first, if it is non-null and begins
+   at GOAL; a reservation anywhere else is given back.  Otherwise
+   they are allocated from the free map, asking for
+   RESERVE_SECTORS more than needed (if RESERVE is non-null) and
+   keeping the excess in RESERVE.  When no run that long is free,
+   shorter runs are tried.  Returns false if the disk is full. */
+static bool
+take_sectors (block_sector_t goal, size_t want, struct reservation *reserve,
+              block_sector_t *startp, size_t *cntp)
+{
+  size_t cnt;
+
+  if (reserve != NULL && reserve->cnt > 0)
+    {
+      if (reserve->start == goal)
+        {
+          *startp = reserve->start;
+          *cntp = want < reserve->cnt ? want : reserve->cnt;
+          reserve->start += *cntp;
+          reserve->cnt -= *cntp;
+          return true;
+        }
+      release_reservation (reserve);
+    }
+
+  for (cnt = want + (reserve != NULL ? RESERVE_SECTORS : 0); cnt > 0;
+       cnt /= 2)
+    {
+      if (goal != 0 && free_map_allocate_at (goal, cnt))
+        *startp = goal;
+      else if (!free_map_allocate (cnt, startp))
+        continue;
+
+      *cntp = cnt < want ? cnt : want;
+      if (reserve != NULL && cnt > want)
+        {
+          reserve->start = *startp + want;
+          reserve->cnt = cnt - want;
+        }
+      return true;
+    }
+  return false;
+}
+
+/* Makes DISK_INODE's data at least LENGTH bytes long by adding a
+   hole at its end.  Does not change its length.  Returns false if
+   a new extent block was needed but could not be allocated. */
+static bool
+extend (struct inode_disk *disk_inode, off_t length)
+{
+  size_t need = bytes_to_sectors (length);
+
+  if (disk_inode->sector_cnt >= need)
+    return true;
+  return append_extent (disk_inode, 0, need - disk_inode->sector_cnt);
+}
+
+/* Allocates sectors for the data sectors of DISK_INODE that a
+   write of SIZE bytes at OFFSET, which must be in a hole, covers,
+   up to the end of the hole.  The caller writes those bytes right
+   after, so only a new sector that the write covers partly is
+   filled with zeros in the cache; zeroing the others would just
+   push them through the cache and to disk twice.  The new
+   sectors are placed right after the data that precedes the
+   hole, if possible, and taken from RESERVE, if non-null, first.
+   Returns false if the disk is full. */
+static bool
+fill_hole (struct inode_disk *disk_inode, off_t offset, off_t size,
+           struct reservation *reserve)
+{
+  struct extent hole, prev, pieces[3];
+  size_t idx = offset / BLOCK_SECTOR_SIZE;
+  size_t cnt = DIV_ROUND_UP (offset % BLOCK_SECTOR_SIZE + size,
+                             BLOCK_SECTOR_SIZE);
+  size_t piece_cnt = 0;
+  size_t base = 0;
+  size_t i, j;
+  block_sector_t goal = 0, start, block;
+  bool merge;
+
+  /* Find the hole, and the extent before it. */
+  for (i = 0; ; i++)
+    {
+      ASSERT (i < disk_inode->extent_cnt);
+      hole = get_extent (disk_inode, i);
+      if (idx < base + hole.length)
+        break;
+      base += hole.length;
+    }
+  ASSERT (hole.start == 0);
+  if (cnt > base + hole.length - idx)
+    cnt = base + hole.length - idx;
+  if (idx == base && i > 0)
+    {
+      prev = get_extent (disk_inode, i - 1);
+      if (prev.start != 0)
+        goal = prev.start + prev.length;
+    }
+
+  if (!take_sectors (goal, cnt, reserve, &start, &cnt))
+    return false;
+  merge = goal != 0 && start == goal;
+
+  /* Replace the hole by what is left of it before and after the
+     new sectors, and the new sectors themselves unless they
+     simply make the previous extent longer. */
+  if (idx > base)
+    pieces[piece_cnt++] = (struct extent) {0, idx - base};
+  if (!merge)
+    pieces[piece_cnt++] = (struct extent) {start, cnt};
+  if (idx + cnt < base + hole.length)
+    pieces[piece_cnt++] = (struct extent) {0, base + hole.length - idx - cnt};
+
+  /* Make room for the extra extents first, so that nothing below
+     can fail half way. */
+  if (piece_cnt > 1
+      && disk_inode->extent_cnt + piece_cnt - 1 > DIRECT_EXTENT_CNT
+      && !locate_extent_block (disk_inode,
+                               disk_inode->extent_cnt + piece_cnt - 2,
+                               true, &block))
+    {
+      free_map_release (start, cnt);
+      return false;
+    }
+
+  if (piece_cnt > 1)
+    for (j = disk_inode->extent_cnt - 1; j > i; j--)
+      put_extent (disk_inode, j + piece_cnt - 1, get_extent (disk_inode, j));
+  else if (piece_cnt == 0)
+    for (j = i + 1; j < disk_inode->extent_cnt; j++)
+      put_extent (disk_inode, j - 1, get_extent (disk_inode, j));
+  for (j = 0; j < piece_cnt; j++)
+    put_extent (disk_inode, i + j, pieces[j]);
+  disk_inode->extent_cnt = disk_inode->extent_cnt + piece_cnt - 1;
+  if (merge)
+    {
+      prev.length += cnt;
+      put_extent (disk_inode, i - 1, prev);
+    }
+
+  for (j = 0; j < cnt; j++)
+    {
+      off_t sector_start = (off_t) (idx + j) * BLOCK_SECTOR_SIZE;
+      if (sector_start < offset
+          || sector_start + BLOCK_SECTOR_SIZE > offset + size)
+        cache_write (start + j, zeros);
+    }
+  return true;
+}
+
+/* Releases all of DISK_INODE's data sectors and extent blocks,
+   but not the inode's own sector. */
+static void
+release_sectors (struct inode_disk *disk_inode)
+{
+  block_sector_t block;
+  size_t i;
+
+  for (i = 0; i < disk_inode->extent_cnt; i++)
+    {
+      struct extent e = get_extent (disk_inode, i);
+      if (e.start != 0)
+        free_map_release (e.start, e.length);
+    }
+
+  for (block = disk_inode->extent_block; block != 0; )
+    {
+      block_sector_t next;
+
+      cache_read_at (block, &next, offsetof (struct extent_block, next),
+                     sizeof next);
+      free_map_release (block, 1);
+      block = next;
+    }
+}
+
+/* Gives the sectors in RESERVE back to the free map. */
+static void
+release_reservation (struct reservation *reserve)
+{
+  if (reserve->cnt > 0)
+    free_map_release (reserve->start, reserve->cnt);
+  reserve->cnt = 0;
+}
@@ -8,16 +8,22 @@
 struct bitmap;
 
 void inode_init (void);
-bool inode_create (block_sector_t, off_t);
+void inode_done (void);
+bool inode_create (block_sector_t, off_t, bool is_dir);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
+bool inode_is_dir (const struct inode *);
+int inode_open_cnt (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+bool inode_is_removed (const struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_read_ahead (struct inode *, off_t offset, off_t size);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+unsigned inode_version (const struct inode *);
 
 #endif /* filesys/inode.h */
@@ -359,6 +359,23 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the bytes of B that hold the CNT bits starting at
+   START to the same place in FILE, which must hold all of B.
+   Return true if successful, false otherwise. */
+bool
+bitmap_write_bits (const struct bitmap *b, struct file *file,
+                   size_t start, size_t cnt)
+{
+  off_t ofs, size;
+
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  ofs = start / CHAR_BIT;
+  size = DIV_ROUND_UP (start + cnt, CHAR_BIT) - ofs;
+  return file_write_at (file, (uint8_t *) b->bits + ofs, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,316 @@
+/* Open-addressing hash table.
+
+   See ohash.h for basic information. */
+
+#include "ohash.h"
+#include "../debug.h"
+#include "threads/malloc.h"
+
+/* Special slot tags.  Real tags are never less than TAG_FIRST. */
+#define TAG_EMPTY   0           /* Slot has never held an element. */
+#define TAG_DELETED 1           /* Old-array slot whose entry is gone. */
+#define TAG_FIRST   2
+
+/* Initial number of slots. */
+#define INITIAL_SLOTS 16
+
+/* Number of old slots moved by each insertion or deletion while a
+   resize is in progress. */
+#define MIGRATE_STEP 8
+
+/* The table grows when it would become more than 3/4 full. */
+#define OVERLOADED(USED, SLOTS) ((USED) * 4 > (SLOTS) * 3)
+
+static unsigned key_tag (uintptr_t);
+static struct ohash_slot *find_slot (struct ohash_slot *, size_t slot_cnt,
+                                     unsigned tag, uintptr_t key);
+static void place (struct ohash *, unsigned tag, uintptr_t key, void *value);
+static void remove_slot (struct ohash *, struct ohash_slot *);
+static bool grow (struct ohash *);
+static void migrate (struct ohash *, size_t slot_cnt);
+
+/* Initializes hash table H.  Returns true if successful, false
+   if memory could not be allocated. */
+bool
+ohash_init (struct ohash *h)
+{
+  h->elem_cnt = 0;
+  h->used_cnt = 0;
+  h->slot_cnt = INITIAL_SLOTS;
+  h->slots = calloc (h->slot_cnt, sizeof *h->slots);
+  h->old_slot_cnt = 0;
+  h->old_slots = NULL;
+  h->migrate_idx = 0;
+  return h->slots != NULL;
+}
+
+/* Removes all the elements from H.
+
+   If DESTRUCTOR is non-null, then it is called for each element
+   in the hash, given auxiliary data AUX.  DESTRUCTOR may free
+   the element's value, but must not modify H. */
+void
+ohash_clear (struct ohash *h, ohash_action_func *destructor, void *aux)
+{
+  size_t i;
+
+  if (destructor != NULL)
+    ohash_apply (h, destructor, aux);
+
+  for (i = 0; i < h->slot_cnt; i++)
+    h->slots[i].tag = TAG_EMPTY;
+  free (h->old_slots);
+  h->old_slots = NULL;
+  h->old_slot_cnt = 0;
+  h->migrate_idx = 0;
+  h->used_cnt = 0;
+  h->elem_cnt = 0;
+}
+
+/* Destroys hash table H, first calling DESTRUCTOR, if non-null,
+   for each element as in ohash_clear(). */
+void
+ohash_destroy (struct ohash *h, ohash_action_func *destructor, void *aux)
+{
+  ohash_clear (h, destructor, aux);
+  free (h->slots);
+  h->slots = NULL;
+  h->slot_cnt = 0;
+}
+
+/* Maps KEY to VALUE in H, which must be non-null.
+   Returns true if successful, false if KEY is already present or
+   if the table is full and memory to grow it is not available. */
+bool
+ohash_insert (struct ohash *h, uintptr_t key, void *value)
+{
+  unsigned tag = key_tag (key);
+
+  ASSERT (value != NULL);
+
+  if (ohash_find (h, key) != NULL)
+    return false;
+
+  migrate (h, MIGRATE_STEP);
+  if (OVERLOADED (h->used_cnt + 1, h->slot_cnt) && !grow (h)
+      && h->used_cnt + 1 >= h->slot_cnt)
+    return false;
+
+  place (h, tag, key, value);
+  h->elem_cnt++;
+  return true;
+}
+
+/* Returns the value mapped to KEY in H, or a null pointer if KEY
+   is not present. */
+void *
+ohash_find (const struct ohash *h, uintptr_t key)
+{
+  unsigned tag = key_tag (key);
+  struct ohash_slot *s;
+
+  s = find_slot (h->slots, h->slot_cnt, tag, key);
+  if (s == NULL && h->old_slots != NULL)
+    s = find_slot (h->old_slots, h->old_slot_cnt, tag, key);
+  return s != NULL ? s->value : NULL;
+}
+
+/* Removes KEY from H and returns the value it was mapped to, or
+   a null pointer if KEY was not present. */
+void *
+ohash_delete (struct ohash *h, uintptr_t key)
+{
+  unsigned tag = key_tag (key);
+  struct ohash_slot *s;
+  void *value;
+
+  s = find_slot (h->slots, h->slot_cnt, tag, key);
+  if (s != NULL)
+    {
+      value = s->value;
+      remove_slot (h, s);
+    }
+  else if (h->old_slots != NULL
+           && (s = find_slot (h->old_slots, h->old_slot_cnt,
+                              tag, key)) != NULL)
+    {
+      value = s->value;
+      s->tag = TAG_DELETED;
+    }
+  else
+    return NULL;
+
+  h->elem_cnt--;
+  migrate (h, MIGRATE_STEP);
+  return value;
+}
+
+/* Calls ACTION for each element in H in arbitrary order, passing
+   AUX.  Modifying H while ohash_apply() is running yields
+   undefined behavior. */
+void
+ohash_apply (struct ohash *h, ohash_action_func *action, void *aux)
+{
+  size_t i;
+
+  ASSERT (action != NULL);
+
+  for (i = 0; i < h->slot_cnt; i++)
+    if (h->slots[i].tag >= TAG_FIRST)
+      action (h->slots[i].key, h->slots[i].value, aux);
+  for (i = h->migrate_idx; i < h->old_slot_cnt; i++)
+    if (h->old_slots[i].tag >= TAG_FIRST)
+      action (h->old_slots[i].key, h->old_slots[i].value, aux);
+}
+
+/* Returns the number of elements in H. */
+size_t
+ohash_size (const struct ohash *h)
+{
+  return h->elem_cnt;
+}
+
+/* Returns true if H contains no elements, false otherwise. */
+bool
+ohash_empty (const struct ohash *h)
+{
+  return h->elem_cnt == 0;
+}
+
+/* Returns the tag for KEY.  Page addresses have 12 zero low bits,
+   so the key is mixed thoroughly (the MurmurHash3 finalizer)
+   before its low bits are used as a slot index. */
+static unsigned
+key_tag (uintptr_t key)
+{
+  unsigned x = key;
+
+  x ^= x >> 16;
+  x *= 0x85ebca6bu;
+  x ^= x >> 13;
+  x *= 0xc2b2ae35u;
+  x ^= x >> 16;
+  return x >= TAG_FIRST ? x : x + TAG_FIRST;
+}
+
+/* Searches the SLOT_CNT slots in SLOTS for KEY, whose tag is TAG.
+   Returns its slot if found, otherwise a null pointer. */
+static struct ohash_slot *
+find_slot (struct ohash_slot *slots, size_t slot_cnt, unsigned tag,
+           uintptr_t key)
+{
+  size_t mask = slot_cnt - 1;
+  size_t i;
+
+  if (slots == NULL)
+    return NULL;
+
+  for (i = tag & mask; slots[i].tag != TAG_EMPTY; i = (i + 1) & mask)
+    if (slots[i].tag == tag && slots[i].key == key)
+      return &slots[i];
+  return NULL;
+}
+
+/* Stores KEY, with tag TAG, and VALUE in the first free slot of
+   H's current array.  The caller must ensure that KEY is not
+   already present and that a free slot exists. */
+static void
+place (struct ohash *h, unsigned tag, uintptr_t key, void *value)
+{
+  size_t mask = h->slot_cnt - 1;
+  size_t i;
+
+  for (i = tag & mask; h->slots[i].tag != TAG_EMPTY; i = (i + 1) & mask)
+    continue;
+  h->slots[i].tag = tag;
+  h->slots[i].key = key;
+  h->slots[i].value = value;
+  h->used_cnt++;
+}
+
+/* Removes slot S from H's current array.  Later entries in the
+   same probe run are shifted back so that lookups never need to
+   skip over deleted slots. */
+static void
+remove_slot (struct ohash *h, struct ohash_slot *s)
+{
+  size_t mask = h->slot_cnt - 1;
+  size_t hole = s - h->slots;
+  size_t i = hole;
+
+  for (;;)
+    {
+      size_t home;
+
+      i = (i + 1) & mask;
+      if (h->slots[i].tag == TAG_EMPTY)
+        break;
+
+      /* An entry may move into the hole only if its home slot is
+         not cyclically within (hole, i]. */
+      home = h->slots[i].tag & mask;
+      if (hole <= i ? hole < home && home <= i : hole < home || home <= i)
+        continue;
+
+      h->slots[hole] = h->slots[i];
+      hole = i;
+    }
+  h->slots[hole].tag = TAG_EMPTY;
+  h->used_cnt--;
+}
+
+/* Starts moving H's elements into a slot array twice as large.
+   If a previous resize is still in progress, finishes it first.
+   Returns false if memory is not available, in which case H is
+   unchanged and still usable. */
+static bool
+grow (struct ohash *h)
+{
+  struct ohash_slot *new_slots;
+  size_t new_slot_cnt = h->slot_cnt * 2;
+
+  migrate (h, h->old_slot_cnt);
+
+  new_slots = calloc (new_slot_cnt, sizeof *new_slots);
+  if (new_slots == NULL)
+    return false;
+
+  h->old_slots = h->slots;
+  h->old_slot_cnt = h->slot_cnt;
+  h->migrate_idx = 0;
+  h->slots = new_slots;
+  h->slot_cnt = new_slot_cnt;
+  h->used_cnt = 0;
+  return true;
+}
+
+/* Moves the elements in up to SLOT_CNT old slots of H into the
+   current slot array.  Frees the old array once it is empty.
+
+   Moved slots are marked deleted rather than empty, because a
+   lookup for a not-yet-moved key may still need to probe past
+   them. */
+static void
+migrate (struct ohash *h, size_t slot_cnt)
+{
+  if (h->old_slots == NULL)
+    return;
+
+  for (; slot_cnt > 0 && h->migrate_idx < h->old_slot_cnt; slot_cnt--)
+    {
+      struct ohash_slot *s = &h->old_slots[h->migrate_idx++];
+      if (s->tag >= TAG_FIRST)
+        {
+          place (h, s->tag, s->key, s->value);
+          s->tag = TAG_DELETED;
+        }
+    }
+
+  if (h->migrate_idx >= h->old_slot_cnt)
+    {
+      free (h->old_slots);
+      h->old_slots = NULL;
+      h->old_slot_cnt = 0;
+      h->migrate_idx = 0;
+    }
+}
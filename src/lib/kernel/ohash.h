@@ -0,0 +1,74 @@
+#ifndef __LIB_KERNEL_OHASH_H
+#define __LIB_KERNEL_OHASH_H
+
+/* Open-addressing hash table.
+
+   An alternative to the chained table in hash.h for hot maps
+   keyed by a single machine word, such as page addresses.
+   Keys and values are stored inline in one flat array of slots,
+   so a lookup usually touches one or two adjacent cache lines
+   instead of chasing list links through the heap.  Collisions
+   are resolved by linear probing, and deletion shifts later
+   entries back so that no tombstones accumulate.
+
+   Growing the table does not rehash everything at once.  A new,
+   twice-as-large slot array is allocated and every later
+   insertion or deletion moves a few entries from the old array
+   to the new one, so no single operation pays for the whole
+   rehash.  Lookups consult both arrays while a resize is in
+   progress.  The slot array never shrinks; ohash_destroy() is
+   the way to give its memory back.
+
+   Unlike struct hash, the table does not embed anything in the
+   stored objects: it maps a uintptr_t KEY to a void * VALUE.
+   Null values are not allowed, because a null pointer is what
+   ohash_find() returns for a missing key. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* One slot of the table. */
+struct ohash_slot
+  {
+    unsigned tag;               /* Hash of KEY; 0 if empty, 1 if deleted. */
+    uintptr_t key;              /* Key. */
+    void *value;                /* Value. */
+  };
+
+/* Open-addressing hash table. */
+struct ohash
+  {
+    size_t elem_cnt;            /* Number of elements in table. */
+    size_t slot_cnt;            /* Number of slots, a power of 2. */
+    size_t used_cnt;            /* Elements stored in `slots'. */
+    struct ohash_slot *slots;   /* Array of `slot_cnt' slots. */
+
+    /* Old slot array, non-null only while a resize is under way. */
+    size_t old_slot_cnt;        /* Number of slots in `old_slots'. */
+    struct ohash_slot *old_slots; /* Entries not yet moved. */
+    size_t migrate_idx;         /* Next old slot to move. */
+  };
+
+/* Performs some operation on the element with KEY and VALUE,
+   given auxiliary data AUX. */
+typedef void ohash_action_func (uintptr_t key, void *value, void *aux);
+
+/* Basic life cycle. */
+bool ohash_init (struct ohash *);
+void ohash_clear (struct ohash *, ohash_action_func *, void *aux);
+void ohash_destroy (struct ohash *, ohash_action_func *, void *aux);
+
+/* Search, insertion, deletion. */
+bool ohash_insert (struct ohash *, uintptr_t key, void *value);
+void *ohash_find (const struct ohash *, uintptr_t key);
+void *ohash_delete (struct ohash *, uintptr_t key);
+
+/* Iteration. */
+void ohash_apply (struct ohash *, ohash_action_func *, void *aux);
+
+/* Information. */
+size_t ohash_size (const struct ohash *);
+bool ohash_empty (const struct ohash *);
+
+#endif /* lib/kernel/ohash.h */
@@ -0,0 +1,244 @@
+/* Test program for lib/kernel/ohash.c, with a benchmark that
+   compares it against the chained table in lib/kernel/hash.c.
+
+   Checks the open-addressing table against a simple reference
+   across random insertions and deletions, including while an
+   incremental resize is in progress.  Then times the same
+   page-address workload (insert everything, look everything up
+   several times, delete everything) on both tables, several
+   times over, and prints the average cost of each operation in
+   CPU timestamp counter cycles.  A run takes well under a timer
+   tick, too little for timer_ticks() to measure.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <hash.h>
+#include <inttypes.h>
+#include <ohash.h>
+#include <random.h>
+#include <stdio.h>
+#include "threads/test.h"
+#include "threads/vaddr.h"
+
+/* Number of keys used by the correctness test and benchmark. */
+#define KEY_CNT 4096
+
+/* Number of lookup passes in the benchmark. */
+#define LOOKUP_PASSES 8
+
+/* Number of times the benchmark runs its workload. */
+#define BENCH_RUNS 16
+
+/* An element of the chained table, keyed like a page. */
+struct value
+  {
+    struct hash_elem elem;      /* Hash table element. */
+    uintptr_t key;              /* Page-aligned key. */
+  };
+
+static struct value values[KEY_CNT];
+static bool present[KEY_CNT];
+
+static void shuffle (struct value[], size_t);
+static unsigned value_hash (const struct hash_elem *, void *);
+static bool value_less (const struct hash_elem *, const struct hash_elem *,
+                        void *);
+static void verify (struct ohash *);
+static void benchmark (void);
+static void bench_chained (uint64_t cycles[3]);
+static void bench_open (uint64_t cycles[3]);
+static inline uint64_t read_tsc (void);
+
+/* Tests the open-addressing table and benchmarks both tables. */
+void
+test (void)
+{
+  struct ohash h;
+  int round;
+  size_t i;
+
+  for (i = 0; i < KEY_CNT; i++)
+    values[i].key = (uintptr_t) i * PGSIZE + 0x08048000;
+
+  printf ("testing ohash:");
+  ASSERT (ohash_init (&h));
+  for (round = 0; round < 16; round++)
+    {
+      printf (" %d", round);
+      for (i = 0; i < KEY_CNT; i++)
+        {
+          size_t idx = random_ulong () % KEY_CNT;
+          if (present[idx])
+            {
+              ASSERT (ohash_delete (&h, values[idx].key) == &values[idx]);
+              present[idx] = false;
+            }
+          else
+            {
+              ASSERT (ohash_insert (&h, values[idx].key, &values[idx]));
+              ASSERT (!ohash_insert (&h, values[idx].key, &values[idx]));
+              present[idx] = true;
+            }
+        }
+      verify (&h);
+    }
+  ohash_destroy (&h, NULL, NULL);
+  printf (" done\n");
+  printf ("ohash: PASS\n");
+
+  benchmark ();
+}
+
+/* Verifies that H contains exactly the keys marked present. */
+static void
+verify (struct ohash *h)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  for (i = 0; i < KEY_CNT; i++)
+    if (present[i])
+      {
+        ASSERT (ohash_find (h, values[i].key) == &values[i]);
+        cnt++;
+      }
+    else
+      ASSERT (ohash_find (h, values[i].key) == NULL);
+  ASSERT (ohash_size (h) == cnt);
+}
+
+/* Runs the same workload on both tables, BENCH_RUNS times, and
+   reports the average timestamp counter cycles per insertion,
+   lookup and deletion in each. */
+static void
+benchmark (void)
+{
+  uint64_t chained[3] = { 0, 0, 0 };
+  uint64_t open[3] = { 0, 0, 0 };
+  int run;
+
+  for (run = 0; run < BENCH_RUNS; run++)
+    {
+      shuffle (values, KEY_CNT);
+      bench_chained (chained);
+      bench_open (open);
+    }
+
+  printf ("hash: %d keys, cycles per insert/lookup/delete: "
+          "%llu/%llu/%llu chained, %llu/%llu/%llu open addressing\n",
+          KEY_CNT,
+          chained[0] / (BENCH_RUNS * KEY_CNT),
+          chained[1] / (BENCH_RUNS * KEY_CNT * LOOKUP_PASSES),
+          chained[2] / (BENCH_RUNS * KEY_CNT),
+          open[0] / (BENCH_RUNS * KEY_CNT),
+          open[1] / (BENCH_RUNS * KEY_CNT * LOOKUP_PASSES),
+          open[2] / (BENCH_RUNS * KEY_CNT));
+}
+
+/* Inserts every key into a chained table, looks each one up
+   LOOKUP_PASSES times, and deletes them all, adding the cycles
+   each phase took to CYCLES[0], [1] and [2]. */
+static void
+bench_chained (uint64_t cycles[3])
+{
+  struct hash h;
+  uint64_t start;
+  int pass;
+  size_t i;
+
+  ASSERT (hash_init (&h, value_hash, value_less, NULL));
+
+  start = read_tsc ();
+  for (i = 0; i < KEY_CNT; i++)
+    hash_insert (&h, &values[i].elem);
+  cycles[0] += read_tsc () - start;
+
+  start = read_tsc ();
+  for (pass = 0; pass < LOOKUP_PASSES; pass++)
+    for (i = 0; i < KEY_CNT; i++)
+      ASSERT (hash_find (&h, &values[i].elem) != NULL);
+  cycles[1] += read_tsc () - start;
+
+  start = read_tsc ();
+  for (i = 0; i < KEY_CNT; i++)
+    hash_delete (&h, &values[i].elem);
+  cycles[2] += read_tsc () - start;
+
+  hash_destroy (&h, NULL);
+}
+
+/* Runs bench_chained()'s workload on an open-addressing table. */
+static void
+bench_open (uint64_t cycles[3])
+{
+  struct ohash h;
+  uint64_t start;
+  int pass;
+  size_t i;
+
+  ASSERT (ohash_init (&h));
+
+  start = read_tsc ();
+  for (i = 0; i < KEY_CNT; i++)
+    ohash_insert (&h, values[i].key, &values[i]);
+  cycles[0] += read_tsc () - start;
+
+  start = read_tsc ();
+  for (pass = 0; pass < LOOKUP_PASSES; pass++)
+    for (i = 0; i < KEY_CNT; i++)
+      ASSERT (ohash_find (&h, values[i].key) == &values[i]);
+  cycles[1] += read_tsc () - start;
+
+  start = read_tsc ();
+  for (i = 0; i < KEY_CNT; i++)
+    ohash_delete (&h, values[i].key);
+  cycles[2] += read_tsc () - start;
+
+  ohash_destroy (&h, NULL, NULL);
+}
+
+/* Returns the CPU's timestamp counter. */
+static inline uint64_t
+read_tsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Shuffles the CNT elements in ARRAY into random order. */
+static void
+shuffle (struct value *array, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      size_t j = i + random_ulong () % (cnt - i);
+      uintptr_t t = array[j].key;
+      array[j].key = array[i].key;
+      array[i].key = t;
+    }
+}
+
+/* Returns a hash value for the value containing E. */
+static unsigned
+value_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct value, elem)->key);
+}
+
+/* Returns true if value A's key is less than value B's. */
+static bool
+value_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct value *a = hash_entry (a_, struct value, elem);
+  const struct value *b = hash_entry (b_, struct value, elem);
+
+  return a->key < b->key;
+}
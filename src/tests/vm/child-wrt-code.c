@@ -0,0 +1,30 @@
+/* Child process of pt-write-code-shared.
+   Given the argument "write", reads data into its own code
+   segment, which must get it killed.  Otherwise, checks that its
+   code segment does not hold that data and exits with code 81. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+
+const char *test_name = "child-wrt-code";
+
+#define SIZE 64
+
+int
+main (int argc, char *argv[])
+{
+  if (argc > 1 && !strcmp (argv[1], "write"))
+    {
+      int handle = open ("sample.txt");
+      if (handle < 2)
+        fail ("open \"sample.txt\"");
+      read (handle, (void *) main, SIZE);
+      fail ("survived reading data into code segment");
+    }
+
+  if (!memcmp ((void *) main, sample, SIZE))
+    fail ("code segment holds data read by an earlier process");
+  return 81;
+}
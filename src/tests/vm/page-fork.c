@@ -0,0 +1,59 @@
+/* Forks a child that shares a 64 kB buffer with its parent
+   copy-on-write.  The child overwrites the buffer, partly with
+   read() from a file descriptor it inherited, and the parent
+   checks that none of that shows through in its copy. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+
+static char buf[SIZE];
+
+/* Fails unless bytes OFS through SIZE - 1 of BUF are all C. */
+static void
+check_buf (size_t ofs, char c)
+{
+  size_t i;
+
+  for (i = ofs; i < SIZE; i++)
+    if (buf[i] != c)
+      fail ("byte %zu is %d, not %d", i, buf[i], c);
+}
+
+void
+test_main (void)
+{
+  size_t size = sizeof sample - 1;
+  pid_t pid;
+  int fd;
+
+  memset (buf, 'p', sizeof buf);
+  CHECK ((fd = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  msg ("fork");
+  pid = fork ();
+  if (pid == 0)
+    {
+      /* The parent reports the child's checks. */
+      quiet = true;
+      check_buf (0, 'p');
+      memset (buf, 'c', sizeof buf);
+      if (read (fd, buf, size) != (int) size)
+        fail ("child read failed");
+      if (memcmp (buf, sample, size))
+        fail ("child read wrong data");
+      check_buf (size, 'c');
+      exit (81);
+    }
+  CHECK (pid > 0, "fork succeeded");
+  CHECK (wait (pid) == 81, "wait for child");
+
+  check_buf (0, 'p');
+  CHECK (read (fd, buf, size) == (int) size, "read \"sample.txt\"");
+  CHECK (!memcmp (buf, sample, size), "compare data");
+  check_buf (size, 'p');
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-fork) begin
+(page-fork) open "sample.txt"
+(page-fork) fork
+(page-fork) fork succeeded
+(page-fork) wait for child
+(page-fork) read "sample.txt"
+(page-fork) compare data
+(page-fork) end
+EOF
+pass;
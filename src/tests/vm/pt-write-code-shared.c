@@ -0,0 +1,20 @@
+/* Has a child try to read data into its code segment, which must
+   kill it, then runs the same program again and checks that its
+   code segment, which may share frames with the first child's,
+   was left unchanged. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  pid_t child;
+
+  CHECK ((child = exec ("child-wrt-code write")) != -1,
+         "exec \"child-wrt-code write\"");
+  CHECK (wait (child) == -1, "wait for child (should return -1)");
+  CHECK ((child = exec ("child-wrt-code")) != -1, "exec \"child-wrt-code\"");
+  CHECK (wait (child) == 81, "wait for child (should return 81)");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pt-write-code-shared) begin
+(pt-write-code-shared) exec "child-wrt-code write"
+(pt-write-code-shared) wait for child (should return -1)
+(pt-write-code-shared) exec "child-wrt-code"
+(pt-write-code-shared) wait for child (should return 81)
+(pt-write-code-shared) end
+EOF
+pass;
@@ -34,6 +34,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -56,6 +57,9 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -ramdisk: Size in kB of RAM disk "ram0", or 0 for none. */
+static size_t ramdisk_kb;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -130,6 +134,7 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  ramdisk_init (ramdisk_kb);
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
@@ -258,6 +263,8 @@ parse_options (char **argv)
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
 #endif
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
@@ -383,6 +390,7 @@ usage (void)
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
+          "  -ramdisk=KB        Create RAM disk ram0 of KB kB.\n"
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
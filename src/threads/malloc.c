@@ -8,6 +8,16 @@
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#ifdef MEMSTAT
+#include "threads/memstat.h"
+
+/* The functions below are the real allocator; the accounting
+   wrappers at the end of this file are built on top of them. */
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+#endif
 
 /* A simple implementation of malloc().
 
@@ -292,3 +302,93 @@ arena_to_block (struct arena *a, size_t idx)
                            + sizeof *a
                            + idx * a->desc->block_size);
 }
+
+#ifdef MEMSTAT
+/* Accounting header placed in front of each block handed out by
+   the memstat_*() functions.  Its size keeps blocks 8-byte
+   aligned. */
+struct memstat_header
+  {
+    size_t size;                /* Requested size in bytes. */
+    memstat_site_t site;        /* Allocating call site. */
+    uint16_t magic;             /* Always MEMSTAT_MAGIC. */
+  };
+
+/* Magic number for detecting blocks without a header. */
+#define MEMSTAT_MAGIC 0x5a17
+
+/* Like malloc(), but charges the block to FILE:LINE. */
+void *
+memstat_malloc (size_t size, const char *file, int line)
+{
+  struct memstat_header *h;
+
+  if (size == 0 || size + sizeof *h < size)
+    return NULL;
+
+  h = malloc (size + sizeof *h);
+  if (h == NULL)
+    return NULL;
+  h->size = size;
+  h->site = memstat_site (file, line);
+  h->magic = MEMSTAT_MAGIC;
+  memstat_alloc (h->site, size, 0);
+  return h + 1;
+}
+
+/* Like calloc(), but charges the block to FILE:LINE. */
+void *
+memstat_calloc (size_t a, size_t b, const char *file, int line)
+{
+  void *p;
+  size_t size;
+
+  size = a * b;
+  if (size < a || size < b)
+    return NULL;
+
+  p = memstat_malloc (size, file, line);
+  if (p != NULL)
+    memset (p, 0, size);
+  return p;
+}
+
+/* Like realloc(), but charges the new block to FILE:LINE. */
+void *
+memstat_realloc (void *old_block, size_t new_size,
+                 const char *file, int line)
+{
+  if (new_size == 0)
+    {
+      memstat_free_block (old_block);
+      return NULL;
+    }
+  else
+    {
+      void *new_block = memstat_malloc (new_size, file, line);
+      if (old_block != NULL && new_block != NULL)
+        {
+          struct memstat_header *h = (struct memstat_header *) old_block - 1;
+          size_t min_size = new_size < h->size ? new_size : h->size;
+          memcpy (new_block, old_block, min_size);
+          memstat_free_block (old_block);
+        }
+      return new_block;
+    }
+}
+
+/* Like free(), for blocks from the memstat_*() functions. */
+void
+memstat_free_block (void *p)
+{
+  if (p != NULL)
+    {
+      struct memstat_header *h = (struct memstat_header *) p - 1;
+
+      ASSERT (h->magic == MEMSTAT_MAGIC);
+      h->magic = 0;
+      memstat_free (h->site, h->size, 0);
+      free (h);
+    }
+}
+#endif /* MEMSTAT */
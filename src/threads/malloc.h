@@ -10,4 +10,20 @@ void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
 
+#ifdef MEMSTAT
+/* Accounting versions of the above; see threads/memstat.h.
+   Every block then carries a small header naming its caller. */
+void *memstat_malloc (size_t, const char *file, int line)
+  __attribute__ ((malloc));
+void *memstat_calloc (size_t, size_t, const char *file, int line)
+  __attribute__ ((malloc));
+void *memstat_realloc (void *, size_t, const char *file, int line);
+void memstat_free_block (void *);
+
+#define malloc(SIZE) memstat_malloc (SIZE, __FILE__, __LINE__)
+#define calloc(A, B) memstat_calloc (A, B, __FILE__, __LINE__)
+#define realloc(P, SIZE) memstat_realloc (P, SIZE, __FILE__, __LINE__)
+#define free(P) memstat_free_block (P)
+#endif /* MEMSTAT */
+
 #endif /* threads/malloc.h */
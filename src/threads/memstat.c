@@ -0,0 +1,221 @@
+#include "threads/memstat.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+
+#ifdef MEMSTAT
+
+/* Kernel memory accounting.  See memstat.h for an overview.
+
+   Call sites and tags live in fixed-size static tables, because
+   the accounting must not itself allocate memory.  Once a table
+   fills up, further sites are folded into index 0 and reported
+   as untracked.  All counters are updated with interrupts off,
+   which is cheap and safe from any kernel context. */
+
+/* Live and peak usage. */
+struct usage
+  {
+    size_t bytes, peak_bytes;   /* Bytes from malloc(). */
+    size_t blocks;              /* Blocks from malloc(). */
+    size_t pages, peak_pages;   /* Pages from palloc_get_*(). */
+  };
+
+/* A subsystem, named after a top-level source directory. */
+struct tag
+  {
+    const char *name;           /* Not null-terminated. */
+    int name_len;               /* Length of NAME. */
+    struct usage usage;
+  };
+
+/* A source file and line that allocates memory. */
+struct site
+  {
+    const char *file;           /* __FILE__, compared by address. */
+    int line;                   /* __LINE__. */
+    struct tag *tag;            /* Subsystem. */
+    struct usage usage;
+  };
+
+#define SITE_CNT 512            /* Power of 2; index 0 is untracked. */
+#define TAG_CNT 16
+
+static struct site sites[SITE_CNT];
+static size_t site_cnt = 1;
+static struct tag tags[TAG_CNT];
+static size_t tag_cnt;
+static struct usage total;
+
+static struct tag *get_tag (const char *file);
+static void usage_add (struct usage *, size_t bytes, size_t pages);
+static void usage_sub (struct usage *, size_t bytes, size_t pages);
+static void print_usage (const struct usage *);
+
+/* Returns the index of the call site at FILE:LINE, registering
+   it if this is its first allocation. */
+memstat_site_t
+memstat_site (const char *file, int line)
+{
+  enum intr_level old_level;
+  unsigned hash = (uintptr_t) file ^ (unsigned) line * 0x9e3779b1u;
+  size_t i = hash & (SITE_CNT - 1);
+  memstat_site_t idx = 0;
+
+  old_level = intr_disable ();
+  for (;; i = (i + 1) & (SITE_CNT - 1))
+    {
+      struct site *s = &sites[i];
+      if (i == 0)
+        continue;
+      if (s->file == file && s->line == line)
+        {
+          idx = i;
+          break;
+        }
+      if (s->file == NULL)
+        {
+          /* Keep the table at most 3/4 full so probes stay short. */
+          if (site_cnt * 4 < SITE_CNT * 3)
+            {
+              s->file = file;
+              s->line = line;
+              s->tag = get_tag (file);
+              site_cnt++;
+              idx = i;
+            }
+          break;
+        }
+    }
+  intr_set_level (old_level);
+
+  return idx;
+}
+
+/* Records that call site SITE allocated BYTES bytes in one
+   malloc() block, or PAGES pages. */
+void
+memstat_alloc (memstat_site_t site, size_t bytes, size_t pages)
+{
+  enum intr_level old_level = intr_disable ();
+  struct site *s = &sites[site];
+
+  usage_add (&s->usage, bytes, pages);
+  if (s->tag != NULL)
+    usage_add (&s->tag->usage, bytes, pages);
+  usage_add (&total, bytes, pages);
+  intr_set_level (old_level);
+}
+
+/* Records that an allocation of BYTES bytes or PAGES pages made
+   by call site SITE was freed. */
+void
+memstat_free (memstat_site_t site, size_t bytes, size_t pages)
+{
+  enum intr_level old_level = intr_disable ();
+  struct site *s = &sites[site];
+
+  usage_sub (&s->usage, bytes, pages);
+  if (s->tag != NULL)
+    usage_sub (&s->tag->usage, bytes, pages);
+  usage_sub (&total, bytes, pages);
+  intr_set_level (old_level);
+}
+
+/* Prints memory usage per tag and every call site that still
+   has memory allocated. */
+void
+memstat_print_stats (void)
+{
+  size_t i;
+
+  printf ("Memory: ");
+  print_usage (&total);
+  for (i = 0; i < tag_cnt; i++)
+    {
+      printf ("  %.*s: ", tags[i].name_len, tags[i].name);
+      print_usage (&tags[i].usage);
+    }
+
+  printf ("Outstanding allocations:\n");
+  for (i = 0; i < SITE_CNT; i++)
+    {
+      const struct site *s = &sites[i];
+      if (s->usage.blocks == 0 && s->usage.pages == 0)
+        continue;
+      if (i == 0)
+        printf ("  (untracked): ");
+      else
+        printf ("  %s:%d: ", s->file, s->line);
+      print_usage (&s->usage);
+    }
+}
+
+/* Returns the tag for source file FILE, which is the first
+   directory in its path after any leading "../" components.
+   Returns a null pointer if the tag table is full. */
+static struct tag *
+get_tag (const char *file)
+{
+  const char *name = file;
+  int name_len;
+  size_t i;
+
+  while (name[0] == '.' && name[1] == '.' && name[2] == '/')
+    name += 3;
+  name_len = strcspn (name, "/");
+
+  for (i = 0; i < tag_cnt; i++)
+    if (tags[i].name_len == name_len
+        && !memcmp (tags[i].name, name, name_len))
+      return &tags[i];
+
+  if (tag_cnt >= TAG_CNT)
+    return NULL;
+  tags[tag_cnt].name = name;
+  tags[tag_cnt].name_len = name_len;
+  return &tags[tag_cnt++];
+}
+
+/* Adds BYTES bytes, in one block if nonzero, and PAGES pages to
+   U, updating its high-water marks. */
+static void
+usage_add (struct usage *u, size_t bytes, size_t pages)
+{
+  if (bytes > 0)
+    {
+      u->bytes += bytes;
+      u->blocks++;
+      if (u->bytes > u->peak_bytes)
+        u->peak_bytes = u->bytes;
+    }
+  u->pages += pages;
+  if (u->pages > u->peak_pages)
+    u->peak_pages = u->pages;
+}
+
+/* Subtracts BYTES bytes, in one block if nonzero, and PAGES pages
+   from U. */
+static void
+usage_sub (struct usage *u, size_t bytes, size_t pages)
+{
+  if (bytes > 0)
+    {
+      ASSERT (u->bytes >= bytes && u->blocks > 0);
+      u->bytes -= bytes;
+      u->blocks--;
+    }
+  ASSERT (u->pages >= pages);
+  u->pages -= pages;
+}
+
+/* Prints U on one line. */
+static void
+print_usage (const struct usage *u)
+{
+  printf ("%zu bytes in %zu blocks (peak %zu), %zu pages (peak %zu)\n",
+          u->bytes, u->blocks, u->peak_bytes, u->pages, u->peak_pages);
+}
+
+#endif /* MEMSTAT */
@@ -0,0 +1,35 @@
+#ifndef THREADS_MEMSTAT_H
+#define THREADS_MEMSTAT_H
+
+/* Kernel memory accounting.
+
+   Compiled in only when MEMSTAT is defined, e.g. by adding
+   "kernel.bin: DEFINES += -DMEMSTAT" to a project's Make.vars.
+   Then malloc() and palloc_get_*() record the source file and
+   line of every call.  Live bytes, live pages and high-water
+   marks are kept per call site and per subsystem ("tag"), which
+   is the top-level source directory of the call site: "vm",
+   "filesys", "userprog" and so on.
+
+   memstat_print_stats() runs at power-off and lists the totals
+   and every call site that still has allocations outstanding,
+   so leaks and footprint regressions show up in test output. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef MEMSTAT
+
+/* Call site index.  Sites that do not fit in the table share
+   index 0; MEMSTAT_NO_SITE marks memory that was never charged. */
+typedef uint16_t memstat_site_t;
+#define MEMSTAT_NO_SITE UINT16_MAX
+
+memstat_site_t memstat_site (const char *file, int line);
+void memstat_alloc (memstat_site_t, size_t bytes, size_t pages);
+void memstat_free (memstat_site_t, size_t bytes, size_t pages);
+void memstat_print_stats (void);
+
+#endif /* MEMSTAT */
+
+#endif /* threads/memstat.h */
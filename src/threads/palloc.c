@@ -7,41 +7,80 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#ifdef MEMSTAT
+#include "threads/memstat.h"
+
+/* The real allocator is implemented below. */
+#undef palloc_get_page
+#undef palloc_get_multiple
+#endif
 
 /* Page allocator.  Hands out memory in page-size (or
    page-multiple) chunks.  See malloc.h for an allocator that
    hands out smaller chunks.
 
-   System memory is divided into two "pools" called the kernel
-   and user pools.  The user pool is for user (virtual) memory
-   pages, the kernel pool for everything else.  The idea here is
-   that the kernel needs to have memory for its own operations
-   even if user processes are swapping like mad.
+   All free memory forms a single pool shared by the kernel and
+   by user (virtual) memory pages.  Kernel pages are allocated
+   from the bottom of the pool and user pages from the top, so
+   the two grow toward each other and the boundary between them
+   moves wherever demand puts it.  Keeping the kernel's pages at
+   one end also keeps free runs long enough for its multi-page
+   allocations.
+
+   The kernel needs to have memory for its own operations even if
+   user processes are swapping like mad, so user pages may never
+   take the last KERNEL_RESERVE_DIV'th of the pool.  The -ul
+   option caps user pages further.
 
-   By default, half of system RAM is given to the kernel pool and
-   half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   The idle thread takes free user pages, zeroes them, and parks
+   them on a small "clean" stack.  Single-page PAL_USER | PAL_ZERO
+   requests are served from that stack first, so page faults that
+   need a zeroed frame usually skip the memset entirely. */
 
 /* A memory pool. */
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    struct bitmap *user_map;            /* Bitmap of user pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t user_cnt;                    /* Number of user pages. */
+                                        /* Changed with interrupts off. */
+    size_t user_max;                    /* Upper bound on user_cnt. */
+#ifdef MEMSTAT
+    memstat_site_t *sites;              /* Call site per allocated page. */
+#endif
   };
 
-/* Two pools: one for kernel data, one for user pages. */
-static struct pool kernel_pool, user_pool;
+/* The pool that holds all free memory. */
+static struct pool page_pool;
+
+/* User pages may use at most all but 1/KERNEL_RESERVE_DIV of
+   the pool. */
+#define KERNEL_RESERVE_DIV 8
+
+/* Pre-zeroed user pages.  These are marked as used user pages
+   in page_pool's bitmaps.  Accessed only with interrupts off,
+   because the idle thread that fills the stack must never sleep
+   on a lock. */
+#define CLEAN_PAGE_MAX 64
+static void *clean_pages[CLEAN_PAGE_MAX];
+static size_t clean_cnt;
+
+static void *clean_page_pop (void);
+static bool clean_pages_release (void);
 
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t user_scan_and_flip (struct pool *, size_t page_cnt);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
-   pages are put into the user pool. */
+   pages may be in use as user pages at any one time. */
 void
 palloc_init (size_t user_page_limit)
 {
@@ -49,43 +88,70 @@ palloc_init (size_t user_page_limit)
   uint8_t *free_start = ptov (1024 * 1024);
   uint8_t *free_end = ptov (init_ram_pages * PGSIZE);
   size_t free_pages = (free_end - free_start) / PGSIZE;
-  size_t user_pages = free_pages / 2;
-  size_t kernel_pages;
-  if (user_pages > user_page_limit)
-    user_pages = user_page_limit;
-  kernel_pages = free_pages - user_pages;
-
-  /* Give half of memory to kernel, half to user. */
-  init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
-  init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
-             user_pages, "user pool");
+  size_t page_cnt;
+
+  init_pool (&page_pool, free_start, free_pages, "page pool");
+
+  page_cnt = bitmap_size (page_pool.used_map);
+  page_pool.user_max = page_cnt - page_cnt / KERNEL_RESERVE_DIV;
+  if (page_pool.user_max > user_page_limit)
+    page_pool.user_max = user_page_limit;
+  printf ("At most %zu pages available for user pages.\n",
+          page_pool.user_max);
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
-   If PAL_USER is set, the pages are obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the pages are filled with zeros.  If too few pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   If PAL_USER is set, the pages are user pages, taken from the
+   top of the pool and counted against the user page limit,
+   otherwise they are taken from the bottom.  If PAL_ZERO is set
+   in FLAGS, then the pages are filled with zeros.  If too few
+   pages are available, returns a null pointer, unless PAL_ASSERT
+   is set in FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
-  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  struct pool *pool = &page_pool;
   void *pages;
   size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  /* A pre-zeroed page needs no further work. */
+  if ((flags & (PAL_USER | PAL_ZERO)) == (PAL_USER | PAL_ZERO)
+      && page_cnt == 1)
+    {
+      pages = clean_page_pop ();
+      if (pages != NULL)
+        return pages;
+    }
+
+  do
+    {
+      lock_acquire (&pool->lock);
+      if (flags & PAL_USER)
+        page_idx = user_scan_and_flip (pool, page_cnt);
+      else
+        page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+      lock_release (&pool->lock);
+    }
+  /* The kernel may take back pages parked on the clean stack. */
+  while (page_idx == BITMAP_ERROR && !(flags & PAL_USER)
+         && clean_pages_release ());
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
   else
     pages = NULL;
 
+  /* Don't fail while the clean stack still holds user pages. */
+  if (pages == NULL && (flags & PAL_USER) && page_cnt == 1)
+    {
+      pages = clean_page_pop ();
+      if (pages != NULL)
+        return pages;
+    }
+
   if (pages != NULL) 
     {
       if (flags & PAL_ZERO)
@@ -102,11 +168,11 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 
 /* Obtains a single free page and returns its kernel virtual
    address.
-   If PAL_USER is set, the page is obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the page is filled with zeros.  If no pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   If PAL_USER is set, the page is a user page, otherwise a
+   kernel page.  If PAL_ZERO is set in FLAGS, then the page is
+   filled with zeros.  If no pages are available, returns a null
+   pointer, unless PAL_ASSERT is set in FLAGS, in which case the
+   kernel panics. */
 void *
 palloc_get_page (enum palloc_flags flags) 
 {
@@ -117,26 +183,43 @@ palloc_get_page (enum palloc_flags flags)
 void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
-  struct pool *pool;
+  struct pool *pool = &page_pool;
   size_t page_idx;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
     return;
 
-  if (page_from_pool (&kernel_pool, pages))
-    pool = &kernel_pool;
-  else if (page_from_pool (&user_pool, pages))
-    pool = &user_pool;
-  else
+  if (!page_from_pool (pool, pages))
     NOT_REACHED ();
 
   page_idx = pg_no (pages) - pg_no (pool->base);
 
+#ifdef MEMSTAT
+  if (pool->sites[page_idx] != MEMSTAT_NO_SITE)
+    {
+      memstat_free (pool->sites[page_idx], 0, page_cnt);
+      pool->sites[page_idx] = MEMSTAT_NO_SITE;
+    }
+#endif
+
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  /* No lock here: a dying thread's page is freed from inside the
+     scheduler.  Bitmap updates are atomic, and the user page
+     count is updated with interrupts off. */
+  if (bitmap_test (pool->user_map, page_idx))
+    {
+      enum intr_level old_level;
+
+      ASSERT (bitmap_all (pool->user_map, page_idx, page_cnt));
+      bitmap_set_multiple (pool->user_map, page_idx, page_cnt, false);
+      old_level = intr_disable ();
+      pool->user_cnt -= page_cnt;
+      intr_set_level (old_level);
+    }
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
 }
@@ -148,15 +231,119 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Zeroes one free user page and pushes it onto the clean stack.
+   Called by the idle thread, so it never sleeps: if the stack is
+   full, it gives up immediately.  Returns true if a page was
+   zeroed, false if there is nothing more to do right now.
+
+   The page is chosen with interrupts off instead of under the
+   pool's lock.  The idle thread is not on the ready list, so if
+   it were preempted holding the lock, allocators would wait for
+   it behind every runnable thread.  Without the lock the scan is
+   still safe: the idle thread only runs when every other thread
+   is blocked, and no thread blocks in the middle of a scan. */
+bool
+palloc_prezero_page (void)
+{
+  enum intr_level old_level;
+  size_t page_idx;
+  void *page;
+
+  if (clean_cnt >= CLEAN_PAGE_MAX)
+    return false;
+
+  old_level = intr_disable ();
+  page_idx = user_scan_and_flip (&page_pool, 1);
+  intr_set_level (old_level);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  page = page_pool.base + PGSIZE * page_idx;
+  memset (page, 0, PGSIZE);
+
+  old_level = intr_disable ();
+  if (clean_cnt < CLEAN_PAGE_MAX)
+    {
+      clean_pages[clean_cnt++] = page;
+      page = NULL;
+    }
+  intr_set_level (old_level);
+
+  /* Lost a race with another filler; hand the page back. */
+  if (page != NULL)
+    palloc_free_page (page);
+  return true;
+}
+
+#ifdef MEMSTAT
+/* Like palloc_get_multiple(), but charges the pages to
+   FILE:LINE. */
+void *
+memstat_palloc_get_multiple (enum palloc_flags flags, size_t page_cnt,
+                             const char *file, int line)
+{
+  struct pool *pool = &page_pool;
+  void *pages = palloc_get_multiple (flags, page_cnt);
+
+  if (pages != NULL)
+    {
+      memstat_site_t site = memstat_site (file, line);
+      pool->sites[pg_no (pages) - pg_no (pool->base)] = site;
+      memstat_alloc (site, 0, page_cnt);
+    }
+  return pages;
+}
+#endif /* MEMSTAT */
+
+/* Pops a page off the clean stack, or returns a null pointer if
+   the stack is empty. */
+static void *
+clean_page_pop (void)
+{
+  enum intr_level old_level;
+  void *page = NULL;
+
+  old_level = intr_disable ();
+  if (clean_cnt > 0)
+    page = clean_pages[--clean_cnt];
+  intr_set_level (old_level);
+
+  return page;
+}
+
+/* Gives every page on the clean stack back to the pool.  Returns
+   true if there were any. */
+static bool
+clean_pages_release (void)
+{
+  bool released = false;
+  void *page;
+
+  while ((page = clean_page_pop ()) != NULL)
+    {
+      palloc_free_page (page);
+      released = true;
+    }
+  return released;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map and user_map at its base.
+     Calculate the space needed for the bitmaps
      and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  size_t user_map_ofs = bitmap_buf_size (page_cnt);
+  size_t bm_size = user_map_ofs * 2;
+  size_t bm_pages;
+#ifdef MEMSTAT
+  /* The per-page call sites go right after the bitmaps. */
+  size_t sites_ofs = ROUND_UP (bm_size, sizeof *p->sites);
+  bm_size = sites_ofs + page_cnt * sizeof *p->sites;
+#endif
+  bm_pages = DIV_ROUND_UP (bm_size, PGSIZE);
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -165,8 +352,17 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, user_map_ofs);
+  p->user_map = bitmap_create_in_buf (page_cnt,
+                                      (uint8_t *) base + user_map_ofs,
+                                      user_map_ofs);
   p->base = base + bm_pages * PGSIZE;
+  p->user_cnt = 0;
+  p->user_max = page_cnt;
+#ifdef MEMSTAT
+  p->sites = (memstat_site_t *) ((uint8_t *) base + sites_ofs);
+  memset (p->sites, 0xff, page_cnt * sizeof *p->sites);
+#endif
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -180,3 +376,35 @@ page_from_pool (const struct pool *pool, void *page)
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Finds PAGE_CNT free consecutive pages in POOL, searching down
+   from the top, and marks them as used user pages.  Returns the
+   index of the first page, or BITMAP_ERROR if there is no such
+   run or taking it would exceed POOL's user page limit.  The
+   caller must hold POOL's lock, or be the idle thread with
+   interrupts off. */
+static size_t
+user_scan_and_flip (struct pool *pool, size_t page_cnt)
+{
+  enum intr_level old_level;
+  size_t page_idx;
+
+  if (pool->user_cnt + page_cnt > pool->user_max
+      || page_cnt > bitmap_size (pool->used_map))
+    return BITMAP_ERROR;
+
+  for (page_idx = bitmap_size (pool->used_map) - page_cnt; ; page_idx--)
+    {
+      if (!bitmap_contains (pool->used_map, page_idx, page_cnt, true))
+        {
+          bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+          bitmap_set_multiple (pool->user_map, page_idx, page_cnt, true);
+          old_level = intr_disable ();
+          pool->user_cnt += page_cnt;
+          intr_set_level (old_level);
+          return page_idx;
+        }
+      if (page_idx == 0)
+        return BITMAP_ERROR;
+    }
+}
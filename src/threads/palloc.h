@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -16,5 +17,18 @@ void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_prezero_page (void);
+
+#ifdef MEMSTAT
+/* Accounting version of palloc_get_multiple(); see
+   threads/memstat.h. */
+void *memstat_palloc_get_multiple (enum palloc_flags, size_t page_cnt,
+                                   const char *file, int line);
+
+#define palloc_get_page(FLAGS) \
+        memstat_palloc_get_multiple (FLAGS, 1, __FILE__, __LINE__)
+#define palloc_get_multiple(FLAGS, CNT) \
+        memstat_palloc_get_multiple (FLAGS, CNT, __FILE__, __LINE__)
+#endif /* MEMSTAT */
 
 #endif /* threads/palloc.h */
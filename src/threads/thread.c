@@ -11,6 +11,9 @@
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#ifdef FILESYS
+#include "filesys/directory.h"
+#endif
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/syscall.h"
@@ -216,6 +219,12 @@ thread_create (const char *name, int priority,
 
   intr_set_level (old_level);
 
+  #ifdef FILESYS
+  /* Inherit the current directory. */
+  if (thread_current ()->cwd != NULL)
+    t->cwd = dir_reopen (thread_current ()->cwd);
+  #endif
+
   #ifdef USERPROG
   t->parent = thread_current()->tid;
   struct child_process *child;
@@ -481,7 +490,8 @@ thread_get_recent_cpu (void)
    to it to enable thread_start() to continue, and immediately
    blocks.  After that, the idle thread never appears in the
    ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   special case when the ready list is empty.  While it has the
+   CPU it pre-zeroes free user pages (see palloc.c). */
 static void
 idle (void *idle_started_ UNUSED)
 {
@@ -495,6 +505,16 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing else wants the CPU, so spend it zeroing free user
+         pages for palloc's clean stack.  Stop as soon as another
+         thread becomes ready. */
+      intr_enable ();
+      while (list_empty (&ready_list) && palloc_prezero_page ())
+        continue;
+      intr_disable ();
+      if (!list_empty (&ready_list))
+        continue;
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
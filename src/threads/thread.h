@@ -6,7 +6,6 @@
 #include <stdint.h>
 #include "threads/synch.h"
 #ifdef VM
-#include <hash.h>
 #include "vm/page.h"
 #endif
 
@@ -121,6 +120,7 @@ struct thread
     struct list files;
     struct file *executing;
     int fd;
+    struct dir *cwd;                    /* Current directory, null for root. */
 
     struct list locks;
 
@@ -133,7 +133,7 @@ struct thread
 #endif
 
 #ifdef VM
-    struct hash *spht;
+    struct sup_page_table *sup_pt;      /* Supplemental page table. */
     void *esp;                          /* Keeps track of current esp for stack growth */
 #endif
 
@@ -4,7 +4,6 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
-#include <hash.h>
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
 #include "vm/frame.h"
@@ -170,6 +169,15 @@ page_fault (struct intr_frame *f)
   void *esp = f->esp;
   void *round_addr = pg_round_down (fault_addr);
 
+  /* First write to a page shared copy-on-write since fork(). */
+  if (!not_present && write && is_user_vaddr (fault_addr)
+      && t->pagedir != NULL && pagedir_is_cow (t->pagedir, round_addr))
+  {
+    if (pagedir_unshare_page (t->pagedir, round_addr))
+      return;
+    goto PAGE_FAULT_VIOLATION;
+  }
+
   if (fault_addr >= PHYS_BASE || !not_present)
     exit (-1);
 
@@ -177,7 +185,8 @@ page_fault (struct intr_frame *f)
   if (user)
   {
     t->esp = esp;
-    if (fault_addr >= (esp - 32))
+    if (fault_addr >= (esp - 32)
+        && sup_page_find (t->sup_pt, round_addr) == NULL)
     {
       if (PHYS_BASE - round_addr > MAX_STACK_SIZE)
         goto PAGE_FAULT_VIOLATION;
@@ -188,41 +197,40 @@ page_fault (struct intr_frame *f)
         goto PAGE_FAULT_VIOLATION;
 
       spt->addr = round_addr;
+      spt->location = ZERO;
+      spt->writable = true;
+
+      if (!sup_page_insert (t->sup_pt, spt))
+      {
+        free (spt);
+        goto PAGE_FAULT_VIOLATION;
+      }
 
-      void *f = falloc_get_frame (round_addr, PAL_USER);
+      void *f = falloc_get_frame (round_addr, PAL_USER | PAL_ZERO);
 
       if (f == NULL)
       {
-        free (spt);
+        free (sup_page_remove (t->sup_pt, round_addr));
         goto PAGE_FAULT_VIOLATION;
       }
 
       if (!install_spt (spt->addr, f, true))
       {
-        free (spt);
+        free (sup_page_remove (t->sup_pt, round_addr));
         falloc_free_frame (f);
         goto PAGE_FAULT_VIOLATION;
       }
 
-      if (hash_insert (t->spht, &spt->hash_elem) != NULL)
-        goto PAGE_FAULT_VIOLATION;
-
       return;
     }
   }
 
   /* spt page fault handling */
-  struct sup_page *spt = (struct sup_page *) malloc (sizeof (struct sup_page));
+  struct sup_page *spt = sup_page_find (t->sup_pt, round_addr);
 
-  spt->addr = round_addr;
-  struct hash_elem *e = hash_find (t->spht, &spt->hash_elem);
-
-  if (e == NULL)
+  if (spt == NULL)
     goto PAGE_FAULT_VIOLATION;
 
-  spt = hash_entry (e, struct sup_page, hash_elem);
-
-  ASSERT (spt != NULL);
   switch (spt->location)
   {
     case FILE_SYSTEM:
@@ -236,8 +244,8 @@ page_fault (struct intr_frame *f)
       break;
   }
 
-  if(!success)
-    goto PAGE_FAULT_VIOLATION;
+  if (success)
+    return;
 
   PAGE_FAULT_VIOLATION:
 
@@ -262,8 +270,29 @@ bool load_file_segment (struct sup_page *spt)
   // struct thread *t = thread_current ();
   // void *addr = pagedir_get_page (t->pagedir, spt->addr);
 
-  /* Get a page of memory. */
-  uint8_t *f = falloc_get_frame (spt->addr, PAL_USER);
+  /* A read-only page can share the page cache's frame for this
+     page of the file. */
+  if (!spt->writable)
+  {
+    uint8_t *kpage = falloc_get_file_frame (file_get_inode (spt->file),
+                                            spt->ofs, spt->read_bytes);
+    if (kpage != NULL)
+    {
+      if (!install_spt (spt->addr, kpage, false))
+      {
+        falloc_free_frame (kpage);
+        return false;
+      }
+      return true;
+    }
+  }
+
+  /* Get a page of memory.  If part of it must be zero, ask for a
+     pre-zeroed frame instead of clearing the tail ourselves. */
+  enum palloc_flags flags = PAL_USER;
+  if (spt->zero_bytes > 0)
+    flags |= PAL_ZERO;
+  uint8_t *f = falloc_get_frame (spt->addr, flags);
   if (f == NULL)
     return false;
 
@@ -273,7 +302,6 @@ bool load_file_segment (struct sup_page *spt)
     falloc_free_frame (f);
     return false;
   }
-  memset (f + spt->read_bytes, 0, spt->zero_bytes);
 
   /* Add the page to the process's address space. */
   if (!install_spt (spt->addr, f, spt->writable))
@@ -292,10 +320,15 @@ bool load_swap_segment (struct sup_page *spt)
 
 bool load_zero_segment (struct sup_page *spt)
 {
-  uint8_t *f = falloc_get_frame (spt->addr, PAL_USER);
+  uint8_t *f = falloc_get_frame (spt->addr, PAL_USER | PAL_ZERO);
   if (f == NULL)
     return false;
 
-  memset (f, 0, PGSIZE);
+  if (!install_spt (spt->addr, f, spt->writable))
+  {
+    falloc_free_frame (f);
+    return false;
+  }
+
   return true;
 }
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include "threads/init.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
@@ -23,7 +26,9 @@ pagedir_create (void)
 }
 
 /* Destroys page directory PD, freeing all the pages it
-   references. */
+   references.  With VM, user pages are frames, which may be
+   shared with the page cache, so they go back to the frame
+   table instead. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
@@ -41,7 +46,11 @@ pagedir_destroy (uint32_t *pd)
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
           if (*pte & PTE_P) 
+#ifdef VM
+            falloc_free_frame (pte_get_page (*pte));
+#else
             palloc_free_page (pte_get_page (*pte));
+#endif
         palloc_free_page (pt);
       }
   palloc_free_page (pd);
@@ -156,6 +165,98 @@ pagedir_clear_page (uint32_t *pd, void *upage)
     }
 }
 
+/* Returns true if user virtual page UPAGE is mapped in PD and
+   the user process may write to it. */
+bool
+pagedir_is_writable (uint32_t *pd, const void *upage)
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+  return pte != NULL && (*pte & (PTE_P | PTE_W)) == (PTE_P | PTE_W);
+}
+
+/* Maps every user page of SRC into DST, which must have no user
+   mappings yet, for fork().  With VM, the two share the frames:
+   writable pages become read-only copy-on-write pages in both,
+   so that the first write to one by either process faults and
+   gets it a private copy (see pagedir_unshare_page()).  Without
+   VM, the pages are copied right away.
+   Returns false if memory allocation fails, in which case DST
+   holds some of the mappings and must still be destroyed. */
+bool
+pagedir_fork (uint32_t *dst, uint32_t *src)
+{
+  uint32_t *pde;
+
+  ASSERT (dst != init_page_dir && src != init_page_dir);
+  for (pde = src; pde < src + pd_no (PHYS_BASE); pde++)
+    if (*pde & PTE_P)
+      {
+        uint32_t *pt = pde_get_pt (*pde);
+        uint32_t *pte;
+
+        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+          if (*pte & PTE_P)
+            {
+              void *upage = (void *) (((uintptr_t) (pde - src) << PDSHIFT)
+                                      | ((uintptr_t) (pte - pt) << PTSHIFT));
+              uint32_t *dst_pte = lookup_page (dst, upage, true);
+
+              if (dst_pte == NULL)
+                return false;
+#ifdef VM
+              if (*pte & PTE_W)
+                *pte = (*pte & ~(uint32_t) PTE_W) | PTE_COW;
+              falloc_share_frame (pte_get_page (*pte));
+              *dst_pte = *pte;
+#else
+              {
+                void *kpage = palloc_get_page (PAL_USER);
+                if (kpage == NULL)
+                  return false;
+                memcpy (kpage, pte_get_page (*pte), PGSIZE);
+                *dst_pte = pte_create_user (kpage, (*pte & PTE_W) != 0);
+              }
+#endif
+            }
+      }
+  invalidate_pagedir (src);
+  return true;
+}
+
+/* Returns true if user virtual page UPAGE is mapped in PD as a
+   copy-on-write page. */
+bool
+pagedir_is_cow (uint32_t *pd, const void *upage)
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+  return pte != NULL && (*pte & (PTE_P | PTE_COW)) == (PTE_P | PTE_COW);
+}
+
+/* Gives PD a private, writable copy of copy-on-write page UPAGE,
+   or just makes UPAGE writable again if no other process still
+   shares it.  Returns false if memory allocation fails. */
+bool
+pagedir_unshare_page (uint32_t *pd, void *upage)
+{
+  uint32_t *pte;
+  void *kpage;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (pagedir_is_cow (pd, upage));
+
+  pte = lookup_page (pd, upage, false);
+#ifdef VM
+  kpage = falloc_unshare_frame (pte_get_page (*pte), upage);
+#else
+  NOT_REACHED ();
+#endif
+  if (kpage == NULL)
+    return false;
+  *pte = pte_create_user (kpage, true) | (*pte & (PTE_A | PTE_D));
+  invalidate_pagedir (pd);
+  return true;
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
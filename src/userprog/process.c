@@ -12,6 +12,7 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
@@ -24,7 +25,9 @@
 #endif
 
 static thread_func start_process NO_RETURN;
+static thread_func fork_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp, char *save_ptr);
+static bool fork_copy (struct thread *parent);
 
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
@@ -92,6 +95,69 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* What fork_process() needs from the process being forked. */
+struct fork_args
+  {
+    struct thread *parent;      /* The process being forked. */
+    struct intr_frame *if_;     /* Its user context in fork(). */
+  };
+
+/* Creates a child process that is a copy of the current one,
+   with the user context IF_, except that fork() returns 0 in the
+   child.  The child shares the parent's memory copy-on-write and
+   gets its own handles for the parent's open files.  Returns
+   the child's pid, or TID_ERROR if it cannot be created. */
+tid_t
+process_fork (struct intr_frame *if_)
+{
+  struct fork_args args;
+  struct child_process *child;
+  tid_t tid;
+
+  args.parent = thread_current ();
+  args.if_ = if_;
+  tid = thread_create (args.parent->name, PRI_DEFAULT, fork_process, &args);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+
+  /* ARGS is on our stack, so wait until the child is done with
+     it, the same way exec() waits for the child to load. */
+  child = search_child_process (tid);
+  while (child->load_status == 0)
+    sema_down (&child->load_sema);
+  if (child->load_status == -1)
+    {
+      child_process_remove (child);
+      return TID_ERROR;
+    }
+  return tid;
+}
+
+/* A thread function that makes the new thread a copy of the
+   process described by ARGS_ and starts it running. */
+static void
+fork_process (void *args_)
+{
+  struct fork_args *args = args_;
+  struct intr_frame if_;
+  bool success;
+
+  memcpy (&if_, args->if_, sizeof if_);
+  if_.eax = 0;
+  success = fork_copy (args->parent);
+
+  if (success) thread_current()->child->load_status = 1;
+  else thread_current()->child->load_status = -1;
+  sema_up(&thread_current()->child->load_sema);
+
+  /* If the copy failed, quit. */
+  if (!success) thread_exit ();
+
+  /* Return to user mode as start_process() does. */
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1(case a).  If TID is invalid or if it
@@ -126,6 +192,8 @@ process_exit (void)
   lock_acquire(&file_lock);
   close_files();
   if(cur->executing != NULL) file_close(cur->executing);
+  dir_close(cur->cwd);
+  cur->cwd = NULL;
   lock_release(&file_lock);
 
   /* Destroy the current process' child processes.
@@ -156,8 +224,11 @@ process_exit (void)
       pagedir_destroy (pd);
     }
 
-  if (cur->spht != NULL)
-    sup_page_destroy (cur->spht);
+  if (cur->sup_pt != NULL)
+    {
+      sup_page_destroy (cur->sup_pt);
+      cur->sup_pt = NULL;
+    }
 }
 
 /* Sets up the CPU for running user code in the current
@@ -239,6 +310,44 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
+/* A loadable segment of an executable, as load_segment() takes
+   it. */
+struct exec_segment
+  {
+    off_t file_page;            /* Page-aligned offset in the file. */
+    uintptr_t mem_page;         /* Page-aligned user address. */
+    uint32_t read_bytes;        /* Bytes to read from the file. */
+    uint32_t zero_bytes;        /* Bytes to zero after them. */
+    bool writable;              /* Writable by the process? */
+  };
+
+/* The result of reading and validating an executable's headers:
+   its entry point and loadable segments. */
+struct exec_image
+  {
+    struct list_elem elem;      /* Element in exec_cache. */
+    struct inode *inode;        /* Executable, kept open. */
+    unsigned version;           /* inode_version() when parsed. */
+    void (*entry) (void);       /* Entry point. */
+    size_t seg_cnt;             /* Number of segments. */
+    struct exec_segment segs[]; /* Segments, in file order. */
+  };
+
+/* Recently loaded executables, most recently used first, so that
+   loading the same program again needs no header I/O or
+   validation.  An entry is dropped when its executable is
+   written, and when it is found removed, since it keeps the
+   executable open and so keeps its sectors allocated.  Protected
+   by file_lock, which load() holds. */
+#define EXEC_CACHE_MAX 8
+static struct list exec_cache = LIST_INITIALIZER (exec_cache);
+static size_t exec_cache_cnt;
+
+static struct exec_image *exec_cache_lookup (struct inode *);
+static void exec_cache_insert (struct inode *, struct exec_image *);
+static void exec_image_free (struct exec_image *);
+static struct exec_image *parse_executable (struct file *,
+                                            const char *file_name);
 static bool setup_stack (void **esp, const char *file_name, char *save_ptr);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
@@ -253,20 +362,18 @@ bool
 load (const char *file_name, void (**eip) (void), void **esp, char *save_ptr)
 {
   struct thread *t = thread_current ();
-  struct Elf32_Ehdr ehdr;
+  struct exec_image *image;
   struct file *file = NULL;
-  off_t file_ofs;
   bool success = false;
-  int i;
+  size_t i;
 
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
 
   /* supplementary page is initialized for each process started */
-  t->spht = (struct hash *)malloc (sizeof (struct hash));
-  sup_page_init (t->spht);
+  t->sup_pt = sup_page_create ();
 
-  if (t->pagedir == NULL || t->spht == NULL)
+  if (t->pagedir == NULL || t->sup_pt == NULL)
     goto done;
   process_activate ();
 
@@ -281,8 +388,118 @@ load (const char *file_name, void (**eip) (void), void **esp, char *save_ptr)
   file_deny_write(file);
   t->executing = file;
 
+  /* Parse the executable, or reuse what was parsed the last
+     time it was loaded. */
+  image = exec_cache_lookup (file_get_inode (file));
+  if (image == NULL)
+    {
+      image = parse_executable (file, file_name);
+      if (image == NULL)
+        goto done;
+      exec_cache_insert (file_get_inode (file), image);
+    }
+
+  /* Load its segments. */
+  for (i = 0; i < image->seg_cnt; i++)
+    {
+      const struct exec_segment *seg = &image->segs[i];
+      if (!load_segment (file, seg->file_page, (void *) seg->mem_page,
+                         seg->read_bytes, seg->zero_bytes, seg->writable))
+        goto done;
+    }
+
+  /* Set up stack. */
+  if (!setup_stack (esp, file_name, save_ptr))
+    goto done;
+
+  /* Start address. */
+  *eip = image->entry;
+
+  success = true;
+ done:
+  /* We arrive here whether the load is successful or not. */
+  lock_release(&file_lock);
+  return success;
+}
+
+/* load() helpers. */
+
+static bool install_page (void *upage, void *kpage, bool writable);
+
+/* Returns the cached image of INODE's executable, or a null
+   pointer if there is none or INODE has been written since it
+   was parsed.  Drops the images of removed executables on the
+   way. */
+static struct exec_image *
+exec_cache_lookup (struct inode *inode)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&exec_cache); e != list_end (&exec_cache); )
+    {
+      struct exec_image *image = list_entry (e, struct exec_image, elem);
+      e = list_next (e);
+      if (inode_is_removed (image->inode))
+        {
+          list_remove (&image->elem);
+          exec_cache_cnt--;
+          exec_image_free (image);
+        }
+      else if (image->inode == inode)
+        {
+          list_remove (&image->elem);
+          if (image->version != inode_version (inode))
+            {
+              exec_cache_cnt--;
+              exec_image_free (image);
+              return NULL;
+            }
+          list_push_front (&exec_cache, &image->elem);
+          return image;
+        }
+    }
+  return NULL;
+}
+
+/* Adds IMAGE, parsed from INODE, to the cache, which takes
+   ownership of it, evicting the least recently used image if the
+   cache is full. */
+static void
+exec_cache_insert (struct inode *inode, struct exec_image *image)
+{
+  image->inode = inode_reopen (inode);
+  image->version = inode_version (inode);
+  list_push_front (&exec_cache, &image->elem);
+  if (++exec_cache_cnt > EXEC_CACHE_MAX)
+    {
+      exec_cache_cnt--;
+      exec_image_free (list_entry (list_pop_back (&exec_cache),
+                                   struct exec_image, elem));
+    }
+}
+
+/* Closes IMAGE's inode and frees IMAGE. */
+static void
+exec_image_free (struct exec_image *image)
+{
+  inode_close (image->inode);
+  free (image);
+}
+
+/* Reads and validates the ELF headers of FILE, named FILE_NAME,
+   and returns its image, allocated with malloc().  Returns a
+   null pointer if FILE is not a loadable executable or memory
+   runs out. */
+static struct exec_image *
+parse_executable (struct file *file, const char *file_name)
+{
+  struct Elf32_Ehdr ehdr;
+  struct exec_image *image;
+  off_t file_ofs;
+  int i;
+
   /* Read and verify executable header. */
-  if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
+  if (file_read_at (file, &ehdr, sizeof ehdr, 0) != sizeof ehdr
       || memcmp (ehdr.e_ident, "\177ELF\1\1\1", 7)
       || ehdr.e_type != 2
       || ehdr.e_machine != 3
@@ -291,9 +508,15 @@ load (const char *file_name, void (**eip) (void), void **esp, char *save_ptr)
       || ehdr.e_phnum > 1024)
     {
       printf ("load: %s: error loading executable\n", file_name);
-      goto done;
+      return NULL;
     }
 
+  image = malloc (sizeof *image + ehdr.e_phnum * sizeof *image->segs);
+  if (image == NULL)
+    return NULL;
+  image->entry = (void (*) (void)) ehdr.e_entry;
+  image->seg_cnt = 0;
+
   /* Read program headers. */
   file_ofs = ehdr.e_phoff;
   for (i = 0; i < ehdr.e_phnum; i++)
@@ -301,11 +524,9 @@ load (const char *file_name, void (**eip) (void), void **esp, char *save_ptr)
       struct Elf32_Phdr phdr;
 
       if (file_ofs < 0 || file_ofs > file_length (file))
-        goto done;
-      file_seek (file, file_ofs);
-
-      if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-        goto done;
+        goto error;
+      if (file_read_at (file, &phdr, sizeof phdr, file_ofs) != sizeof phdr)
+        goto error;
       file_ofs += sizeof phdr;
       switch (phdr.p_type)
         {
@@ -319,57 +540,44 @@ load (const char *file_name, void (**eip) (void), void **esp, char *save_ptr)
         case PT_DYNAMIC:
         case PT_INTERP:
         case PT_SHLIB:
-          goto done;
+          goto error;
         case PT_LOAD:
           if (validate_segment (&phdr, file))
             {
-              bool writable = (phdr.p_flags & PF_W) != 0;
-              uint32_t file_page = phdr.p_offset & ~PGMASK;
-              uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
+              struct exec_segment *seg = &image->segs[image->seg_cnt++];
               uint32_t page_offset = phdr.p_vaddr & PGMASK;
-              uint32_t read_bytes, zero_bytes;
+              seg->writable = (phdr.p_flags & PF_W) != 0;
+              seg->file_page = phdr.p_offset & ~PGMASK;
+              seg->mem_page = phdr.p_vaddr & ~PGMASK;
               if (phdr.p_filesz > 0)
                 {
                   /* Normal segment.
                      Read initial part from disk and zero the rest. */
-                  read_bytes = page_offset + phdr.p_filesz;
-                  zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-                                - read_bytes);
+                  seg->read_bytes = page_offset + phdr.p_filesz;
+                  seg->zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz,
+                                               PGSIZE)
+                                     - seg->read_bytes);
                 }
               else
                 {
                   /* Entirely zero.
                      Don't read anything from disk. */
-                  read_bytes = 0;
-                  zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
+                  seg->read_bytes = 0;
+                  seg->zero_bytes = ROUND_UP (page_offset + phdr.p_memsz,
+                                              PGSIZE);
                 }
-              if (!load_segment (file, file_page, (void *) mem_page,
-                                 read_bytes, zero_bytes, writable))
-                goto done;
             }
           else
-            goto done;
+            goto error;
           break;
         }
     }
+  return image;
 
-  /* Set up stack. */
-  if (!setup_stack (esp, file_name, save_ptr))
-    goto done;
-
-  /* Start address. */
-  *eip = (void (*) (void)) ehdr.e_entry;
-
-  success = true;
- done:
-  /* We arrive here whether the load is successful or not. */
-  lock_release(&file_lock);
-  return success;
+ error:
+  free (image);
+  return NULL;
 }
-
-/* load() helpers. */
-
-static bool install_page (void *upage, void *kpage, bool writable);
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -438,7 +646,6 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0)
     {
       /* Calculate how to fill this page.
@@ -447,18 +654,28 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-      /* Get a page of memory. */
-      uint8_t *kpage = falloc_get_frame (upage, PAL_USER);
+      /* Share the page cache's frame for a read-only page of the
+         file if possible.  Otherwise, get a page of memory,
+         pre-zeroed if any of it must be zero, and load it. */
+      uint8_t *kpage = NULL;
+      if (!writable)
+        kpage = falloc_get_file_frame (file_get_inode (file), ofs,
+                                       page_read_bytes);
       if (kpage == NULL)
-        return false;
-
-      /* Load this page. */
-      if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes)
         {
-          falloc_free_frame (kpage);
-          return false;
+          kpage = falloc_get_frame (upage, page_zero_bytes > 0
+                                           ? PAL_USER | PAL_ZERO
+                                           : PAL_USER);
+          if (kpage == NULL)
+            return false;
+
+          if (file_read_at (file, kpage, page_read_bytes, ofs)
+              != (int) page_read_bytes)
+            {
+              falloc_free_frame (kpage);
+              return false;
+            }
         }
-      memset (kpage + page_read_bytes, 0, page_zero_bytes);
 
       /* Add the page to the process's address space. */
       if (!install_page (upage, kpage, writable))
@@ -480,8 +697,8 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       //   spt->writable = writable;
 
       //   // printf("wrote down all the info on spt\n\n");
-      //   ASSERT (t->spht != NULL);
-      //   ASSERT (hash_insert (t->spht, &spt->hash_elem) == NULL);
+      //   ASSERT (t->sup_pt != NULL);
+      //   ASSERT (sup_page_insert (t->sup_pt, spt));
       //   // printf("hash inserted\n\n");
       // }
       // else
@@ -491,7 +708,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       read_bytes -= page_read_bytes;
       zero_bytes -= page_zero_bytes;
       upage += PGSIZE;
-      // ofs += page_read_bytes;
+      ofs += PGSIZE;
     }
   return true;
 }
@@ -504,13 +721,14 @@ setup_stack (void **esp, const char *file_name, char *save_ptr)
   uint8_t *kpage;
   bool success = false;
 
-  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+  kpage = falloc_get_frame (((uint8_t *) PHYS_BASE) - PGSIZE,
+                            PAL_USER | PAL_ZERO);
   if (kpage == NULL) return success;
   success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
   if (success)
     *esp = PHYS_BASE;
   else{
-    palloc_free_page (kpage);
+    falloc_free_frame (kpage);
     return success;
   }
 
@@ -599,6 +817,108 @@ install_spt (void *upage, void *kpage, bool writable)
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
 
+/* fork() helpers. */
+
+/* Auxiliary data for fork_sup_page(). */
+struct fork_sup
+  {
+    struct sup_page_table *spt; /* Table to copy into. */
+    bool success;               /* False once an allocation fails. */
+  };
+
+/* Adds a copy of P to the table in AUX_, a struct fork_sup. */
+static void
+fork_sup_page (struct sup_page *p, void *aux_)
+{
+  struct fork_sup *aux = aux_;
+  struct sup_page *copy;
+
+  if (!aux->success)
+    return;
+  copy = malloc (sizeof *copy);
+  if (copy == NULL)
+    {
+      aux->success = false;
+      return;
+    }
+  *copy = *p;
+  if (!sup_page_insert (aux->spt, copy))
+    {
+      free (copy);
+      aux->success = false;
+    }
+}
+
+/* Gives the current thread, which fork_process() is running, a
+   copy of PARENT's address space, open files and executable.
+   The current directory was already inherited by
+   thread_create().  Returns true if successful, false if memory
+   runs out, in which case process_exit() frees whatever was
+   copied. */
+static bool
+fork_copy (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  struct fork_sup aux;
+  struct list_elem *e;
+  bool success = false;
+
+  /* Share the parent's pages. */
+  t->pagedir = pagedir_create ();
+  t->sup_pt = sup_page_create ();
+  if (t->pagedir == NULL || t->sup_pt == NULL)
+    return false;
+  process_activate ();
+  if (!pagedir_fork (t->pagedir, parent->pagedir))
+    return false;
+  aux.spt = t->sup_pt;
+  aux.success = true;
+  sup_page_apply (parent->sup_pt, NULL, PHYS_BASE, fork_sup_page, &aux);
+  if (!aux.success)
+    return false;
+  t->esp = parent->esp;
+
+  /* Reopen the parent's files at the same positions, keeping
+     their descriptors. */
+  lock_acquire(&file_lock);
+  for (e = list_begin (&parent->files); e != list_end (&parent->files);
+       e = list_next (e))
+    {
+      struct filestruct *pfst = list_entry (e, struct filestruct, elem);
+      struct filestruct *fst = malloc (sizeof *fst);
+      if (fst == NULL)
+        goto done;
+      fst->fd = pfst->fd;
+      fst->file = file_reopen (pfst->file);
+      fst->dir = pfst->dir != NULL ? dir_reopen (pfst->dir) : NULL;
+      if (fst->file == NULL || (pfst->dir != NULL && fst->dir == NULL))
+        {
+          file_close (fst->file);
+          dir_close (fst->dir);
+          free (fst);
+          goto done;
+        }
+      file_seek (fst->file, file_tell (pfst->file));
+      list_push_back (&t->files, &fst->elem);
+    }
+  t->fd = parent->fd;
+
+  /* Set last, since process_exit() takes a process with an
+     executable to have started. */
+  if (parent->executing != NULL)
+    {
+      t->executing = file_reopen (parent->executing);
+      if (t->executing == NULL)
+        goto done;
+      file_deny_write (t->executing);
+    }
+
+  success = true;
+ done:
+  lock_release(&file_lock);
+  return success;
+}
+
 /* Close all the files current process has. */
 void close_files(void){
   struct thread *t = thread_current();
@@ -606,6 +926,7 @@ void close_files(void){
   while(e != list_end(&t->files)){
     struct filestruct *fst = list_entry(e, struct filestruct, elem);
     file_close(fst->file);
+    dir_close(fst->dir);
     e = list_remove(e);
     free(fst);
   }
@@ -7,6 +7,7 @@
 #include "threads/thread.h"
 #include "threads/malloc.h"
 #include "threads/vaddr.h"
+#include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
@@ -126,6 +127,47 @@ syscall_handler (struct intr_frame *f UNUSED)
             ret_args(f->esp, &arg[0], 1);
             close(arg[0]);
             break;
+
+        /* Change the current directory.
+           Takes 1 arg */
+        case SYS_CHDIR:
+            ret_args(f->esp, &arg[0], 1);
+            f->eax = chdir((const char *)arg[0]);
+            break;
+
+        /* Create a directory.
+           Takes 1 arg */
+        case SYS_MKDIR:
+            ret_args(f->esp, &arg[0], 1);
+            f->eax = mkdir((const char *)arg[0]);
+            break;
+
+        /* Read a directory entry.
+           Takes 2 args */
+        case SYS_READDIR:
+            ret_args(f->esp, &arg[0], 2);
+            f->eax = readdir(arg[0], (char *)arg[1]);
+            break;
+
+        /* Test if a fd represents a directory.
+           Takes 1 arg */
+        case SYS_ISDIR:
+            ret_args(f->esp, &arg[0], 1);
+            f->eax = isdir(arg[0]);
+            break;
+
+        /* Return the inode number for a fd.
+           Takes 1 arg */
+        case SYS_INUMBER:
+            ret_args(f->esp, &arg[0], 1);
+            f->eax = inumber(arg[0]);
+            break;
+
+        /* Duplicate this process.
+           No arg is needed */
+        case SYS_FORK:
+            f->eax = process_fork(f);
+            break;
     }
 }
 
@@ -215,6 +257,18 @@ int open(const char *file){
     struct filestruct *fst = malloc(sizeof(struct filestruct));
     if(fst == NULL) return -1;
     fst->file = f;
+    fst->dir = NULL;
+    struct inode *inode = file_get_inode(f);
+    if(inode_is_dir(inode)){
+        /* Keep a directory handle for readdir. */
+        fst->dir = dir_open(inode_reopen(inode));
+        if(fst->dir == NULL){
+            file_close(f);
+            free(fst);
+            lock_release(&file_lock);
+            return -1;
+        }
+    }
     fst->fd = thread_current()->fd;
     thread_current()->fd++;
     list_push_back(&thread_current()->files, &fst->elem);
@@ -242,13 +296,16 @@ int filesize(int fd){
 int read(int fd, void *buffer, unsigned size)
 {
     is_val_buff((const void *)buffer, size);
-    void *kbuf = utk_ptr((const void *)buffer);
+    unshare_buff(buffer, size);
+    is_writable_buff(buffer, size);
+    /* Consecutive user pages need not be contiguous in the
+       kernel's mapping, so each page is translated in turn. */
     if(fd == 0){
         /* STDIN */
-        uint8_t *local_buff = (uint8_t *)kbuf;
         unsigned i;
-        for(i = 0; i< size ; i++){
-            local_buff[i] = input_getc();
+        for(i = 0; i < size; i++){
+            uint8_t *kptr = utk_ptr((uint8_t *)buffer + i);
+            *kptr = input_getc();
         }
         return size;
     }
@@ -258,7 +315,17 @@ int read(int fd, void *buffer, unsigned size)
         lock_release(&file_lock);
         return -1;
     }
-    int nob = file_read(f, kbuf, size);
+    /* Read straight into the frame behind each user page. */
+    int nob = 0;
+    while(size > 0){
+        unsigned chunk = PGSIZE - pg_ofs(buffer);
+        if(chunk > size) chunk = size;
+        int n = file_read(f, utk_ptr(buffer), chunk);
+        nob += n;
+        if(n < (int)chunk) break;
+        buffer = (uint8_t *)buffer + chunk;
+        size -= chunk;
+    }
     lock_release(&file_lock);
     return nob;
 }
@@ -268,19 +335,36 @@ int read(int fd, void *buffer, unsigned size)
    than size if some bytes could not be written. */
 int write(int fd, const void *buffer, unsigned size){
     is_val_buff(buffer, size);
-    void *kbuf = utk_ptr(buffer);
+    /* Consecutive user pages need not be contiguous in the
+       kernel's mapping, so write from each page in turn. */
     if(fd == 1){
         /* STDOUT */
-        putbuf((const void *)kbuf, size);
+        unsigned left = size;
+        while(left > 0){
+            unsigned chunk = PGSIZE - pg_ofs(buffer);
+            if(chunk > left) chunk = left;
+            putbuf((const char *)utk_ptr(buffer), chunk);
+            buffer = (const uint8_t *)buffer + chunk;
+            left -= chunk;
+        }
         return size;
     }
     lock_acquire(&file_lock);
     struct file *f = search_file(fd);
-    if(f == NULL){
+    if(f == NULL || inode_is_dir(file_get_inode(f))){
         lock_release(&file_lock);
         return -1;
     }
-    int nob = file_write(f, kbuf, size);
+    int nob = 0;
+    while(size > 0){
+        unsigned chunk = PGSIZE - pg_ofs(buffer);
+        if(chunk > size) chunk = size;
+        int n = file_write(f, utk_ptr(buffer), chunk);
+        nob += n;
+        if(n < (int)chunk) break;
+        buffer = (const uint8_t *)buffer + chunk;
+        size -= chunk;
+    }
     lock_release(&file_lock);
     return nob;
 }
@@ -322,6 +406,7 @@ void close(int fd){
         struct filestruct *fst = list_entry(e, struct filestruct, elem);
         if(fst->fd == fd){
             file_close(fst->file);
+            dir_close(fst->dir);
             list_remove(&fst->elem);
             free(fst);
             return;
@@ -330,6 +415,60 @@ void close(int fd){
     }
 }
 
+/* Changes the current working directory of the process to dir,
+   which may be relative or absolute. Returns true if successful,
+   false on failure. */
+bool chdir(const char *dir){
+    is_val_str((const void *)dir);
+    char* dn = (char *)utk_ptr((const void *)dir);
+    lock_acquire(&file_lock);
+    bool success = filesys_chdir((const char *)dn);
+    lock_release(&file_lock);
+    return success;
+}
+
+/* Creates the directory named dir, which may be relative or
+   absolute. Returns true if successful, false on failure. */
+bool mkdir(const char *dir){
+    is_val_str((const void *)dir);
+    char* dn = (char *)utk_ptr((const void *)dir);
+    lock_acquire(&file_lock);
+    bool success = filesys_mkdir((const char *)dn);
+    lock_release(&file_lock);
+    return success;
+}
+
+/* Reads a directory entry from fd, which must represent a
+   directory, into name, which must have room for NAME_MAX + 1
+   bytes. Returns false if there are no entries left or fd is not
+   a directory. "." and ".." are never returned. */
+bool readdir(int fd, char *name){
+    is_val_buff((const void *)name, NAME_MAX + 1);
+    unshare_buff(name, NAME_MAX + 1);
+    is_writable_buff(name, NAME_MAX + 1);
+    char *kname = (char *)utk_ptr((const void *)name);
+    lock_acquire(&file_lock);
+    struct filestruct *fst = search_filestruct(fd);
+    bool success = fst != NULL && fst->dir != NULL
+                   && dir_readdir(fst->dir, kname);
+    lock_release(&file_lock);
+    return success;
+}
+
+/* Returns true if fd represents a directory, false if it
+   represents an ordinary file. */
+bool isdir(int fd){
+    struct filestruct *fst = search_filestruct(fd);
+    return fst != NULL && fst->dir != NULL;
+}
+
+/* Returns the inode number of the inode associated with fd. */
+int inumber(int fd){
+    struct file *f = search_file(fd);
+    if(f == NULL) return -1;
+    return (int)inode_get_inumber(file_get_inode(f));
+}
+
 /* Checks if the given pointer PTR is valid(> USR_BOT, < PHYS_BASE)
    or not. Using is_user_vaddr for checking it. */
 void is_val_ptr(const void *ptr){
@@ -344,10 +483,45 @@ void is_val_ptr(const void *ptr){
 /* Checks if the given buffer pointer BUFF is valid with the size N */
 void is_val_buff(const void *buffer, unsigned size){
     char *ptr = (char *)buffer;
-    unsigned i;
-    for(i = 0; i < size; i++){
+    if(size == 0) return;
+    /* One byte per page is enough; check the last byte too. */
+    while(size > PGSIZE - pg_ofs(ptr)){
         is_val_ptr((const void *)ptr);
-        ptr++;
+        size -= PGSIZE - pg_ofs(ptr);
+        ptr += PGSIZE - pg_ofs(ptr);
+    }
+    is_val_ptr((const void *)ptr);
+    is_val_ptr((const void *)(ptr + size - 1));
+}
+
+/* Gives the process its own copy of every copy-on-write page of
+   the valid buffer BUFFER with the size N, before the kernel
+   writes to it. The kernel writes through its own mapping of the
+   frame, so it would not fault and the copy would not happen. */
+void unshare_buff(void *buffer, unsigned size){
+    uint32_t *pd = thread_current()->pagedir;
+    uint8_t *page = pg_round_down(buffer);
+    if(size == 0) return;
+    while(page < (uint8_t *)buffer + size){
+        if(pagedir_is_cow(pd, page) && !pagedir_unshare_page(pd, page))
+            exit(-1);
+        page += PGSIZE;
+    }
+}
+
+/* Checks that the process may write to every page of the valid
+   buffer BUFFER with the size N. The kernel writes through its
+   own mapping of the frame, which ignores the user page's
+   protection, and a read-only page may be a frame shared with
+   other processes through the page cache. */
+void is_writable_buff(const void *buffer, unsigned size){
+    uint32_t *pd = thread_current()->pagedir;
+    const uint8_t *page = pg_round_down(buffer);
+    if(size == 0) return;
+    while(page < (const uint8_t *)buffer + size){
+        if(!pagedir_is_writable(pd, page))
+            exit(-1);
+        page += PGSIZE;
     }
 }
 
@@ -440,3 +614,16 @@ struct file * search_file(int fd){
     }
     return NULL;
 }
+
+/* Returns the filestruct with the given FD.
+   If there isn't one, returns NULL */
+struct filestruct * search_filestruct(int fd){
+    struct thread *t = thread_current();
+    struct list_elem *e = list_begin(&t->files);
+    while(e != list_end(&t->files)){
+        struct filestruct *fst = list_entry(e, struct filestruct, elem);
+        if(fst->fd == fd) return fst;
+        e = list_next(e);
+    }
+    return NULL;
+}
@@ -9,6 +9,7 @@ struct lock file_lock;
 struct filestruct{
     int fd;
     struct file *file;
+    struct dir *dir;            /* Non-null if FILE is a directory. */
     struct list_elem elem;
 };
 
@@ -27,8 +28,15 @@ int write(int , const void *, unsigned );
 void seek (int , unsigned );
 unsigned tell(int );
 void close(int );
+bool chdir(const char *);
+bool mkdir(const char *);
+bool readdir(int, char *);
+bool isdir(int);
+int inumber(int);
 void is_val_ptr(const void *);
 void is_val_buff(const void *, unsigned);
+void unshare_buff(void *, unsigned);
+void is_writable_buff(const void *, unsigned);
 void is_val_str (const void *);
 void ret_args(void *, int *, int);
 struct child_process* child_proc_init (tid_t);
@@ -37,6 +45,7 @@ void child_process_remove(struct child_process*);
 void * utk_ptr(const void *);
 struct child_process * search_child_process(int);
 struct file * search_file(int);
+struct filestruct * search_filestruct(int);
 
 
 #endif /* userprog/syscall.h */
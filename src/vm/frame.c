@@ -1,40 +1,59 @@
-#include <hash.h>
+#include <ohash.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/synch.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "filesys/inode.h"
+#include "userprog/syscall.h"
 #include "vm/frame.h"
 
-struct hash frame_table;
+/* Frame table, keyed by the frame's kernel virtual address.
+   Open addressing keeps a lookup to one or two cache lines and
+   resizes incrementally, so no fault pays for a full rehash. */
+struct ohash frame_table;
 struct lock frame_lock;
 
-unsigned frame_hash (const struct hash_elem *f_, void *aux UNUSED);
-bool frame_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED);
+/* Page cache.  Frames that hold a page of a file, keyed by
+   (inode, page offset), so that every read-only mapping of the
+   same file page shares one frame and read() of resident data is
+   served without going to the sector cache.  A cached frame
+   holds the file's bytes and zeros past end of file, and writes
+   to the file update it in place.
+
+   A cached frame that is no longer mapped stays cached on the
+   idle list, least recently used first, until more than
+   IDLE_MAX pages are idle or palloc runs out of pages, and is
+   then evicted.  The pages of a removed file are evicted as soon
+   as they are idle, since each holds the file open and so keeps
+   its sectors allocated.  Everything here is protected by
+   frame_lock. */
+#define IDLE_MAX 64
+static struct hash page_cache;
+static struct list idle_pages;
+static size_t idle_cnt;
+
+/* Incremented by every write to a file, so that a page read
+   from a file while it was being written can be recognized and
+   read again. */
+static unsigned cache_gen;
+
+static hash_hash_func cache_hash;
+static hash_less_func cache_less;
+static struct frame *cache_lookup (struct inode *, off_t ofs);
+static struct frame *pop_idle (void);
+static void uncache (struct frame *);
+static void discard (struct frame *);
 
 void
 frame_init (void)
 {
-	hash_init (&frame_table, frame_hash, frame_less, NULL);
+	if (!ohash_init (&frame_table))
+		PANIC ("frame table allocation failed");
 	lock_init (&frame_lock);
-}
-
-/* Returns a hash value for frame f. */
-unsigned
-frame_hash (const struct hash_elem *f_, void *aux UNUSED)
-{
-  const struct frame *f = hash_entry (f_, struct frame, hash_elem);
-  return hash_bytes (&f->addr, sizeof f->addr);
-}
-
-/* Returns true if frame a precedes frame b. */
-bool
-frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
-           void *aux UNUSED)
-{
-  const struct frame *a = hash_entry (a_, struct frame, hash_elem);
-  const struct frame *b = hash_entry (b_, struct frame, hash_elem);
-
-  return a->addr < b->addr;
+	hash_init (&page_cache, cache_hash, cache_less, NULL);
+	list_init (&idle_pages);
 }
 
 void *
@@ -45,41 +64,364 @@ falloc_get_frame (void *upage, enum palloc_flags flags)
 
 	void *f = palloc_get_page (flags);
 
-	if (f == NULL)
+	/* Out of pages: evict idle cached pages until one comes free. */
+	while (f == NULL)
 	{
-		//evict
+		struct frame *victim;
+
+		lock_acquire (&frame_lock);
+		victim = pop_idle ();
+		lock_release (&frame_lock);
+		if (victim == NULL)
+			return NULL;
+		discard (victim);
+		f = palloc_get_page (flags);
 	}
-	else
+
+	struct frame *frame = (struct frame*) malloc (sizeof (struct frame));
+	if (frame == NULL)
+	{
+		palloc_free_page (f);
+		return NULL;
+	}
+	frame->addr = f;
+	frame->thread = thread_current ();
+	frame->upage = upage;
+	frame->map_cnt = 1;
+	frame->inode = NULL;
+	lock_acquire (&frame_lock);
+	if (!ohash_insert (&frame_table, (uintptr_t) f, frame))
 	{
-		struct frame *frame = (struct frame*) malloc (sizeof (struct frame));
-		frame->addr = f;
-		frame->thread = thread_current ();
-		frame->upage = upage;
-		lock_acquire (&frame_lock);
-		hash_insert (&frame_table, &frame->hash_elem);
 		lock_release (&frame_lock);
+		free (frame);
+		palloc_free_page (f);
+		return NULL;
 	}
+	lock_release (&frame_lock);
 	return f;
 }
 
-void 
+/* Returns a frame holding the page of INODE at page-aligned
+   offset OFS, from the page cache if it is there, otherwise
+   read from the file and added to the cache.  The frame must
+   only be mapped read-only.  READ_BYTES is the number of bytes
+   the caller wants from the file, the rest of the page being
+   zero; a cached page can only stand in when that is all of the
+   file's data in the page.  Returns a null pointer if it is not,
+   or if memory or the read fails. */
+void *
+falloc_get_file_frame (struct inode *inode, off_t ofs, size_t read_bytes)
+{
+	off_t length = inode_length (inode);
+	struct frame *f;
+	void *kpage;
+	unsigned gen;
+
+	ASSERT (ofs % PGSIZE == 0);
+
+	if (ofs >= length
+	    || read_bytes != (size_t) (length - ofs < PGSIZE
+	                               ? length - ofs : PGSIZE))
+		return NULL;
+
+	for (;;)
+	{
+		lock_acquire (&frame_lock);
+		f = cache_lookup (inode, ofs);
+		if (f != NULL)
+			break;
+		gen = cache_gen;
+		lock_release (&frame_lock);
+
+		kpage = falloc_get_frame (NULL, read_bytes < PGSIZE
+		                                ? PAL_USER | PAL_ZERO : PAL_USER);
+		if (kpage == NULL)
+			return NULL;
+		if (inode_read_at (inode, kpage, read_bytes, ofs)
+		    != (off_t) read_bytes)
+		{
+			falloc_free_frame (kpage);
+			return NULL;
+		}
+
+		lock_acquire (&frame_lock);
+		f = cache_lookup (inode, ofs);
+		if (f == NULL && gen == cache_gen)
+		{
+			f = ohash_find (&frame_table, (uintptr_t) kpage);
+			f->thread = NULL;
+			f->inode = inode_reopen (inode);
+			f->ofs = ofs;
+			hash_insert (&page_cache, &f->cache_elem);
+			lock_release (&frame_lock);
+			return kpage;
+		}
+
+		/* Someone else cached the page first, or the file was
+		   written while we read it. */
+		lock_release (&frame_lock);
+		falloc_free_frame (kpage);
+	}
+
+	if (f->map_cnt++ == 0)
+	{
+		list_remove (&f->idle_elem);
+		idle_cnt--;
+	}
+	lock_release (&frame_lock);
+	return f->addr;
+}
+
+void
 falloc_free_frame (void *frame)
 {
 	struct frame *f;
-	struct hash_elem *e;
-	struct frame *elem = (struct frame *) malloc (sizeof (struct frame));
-	elem->addr = frame;
+	struct frame *victim = NULL;
 
-	e = hash_find (&frame_table, &elem->hash_elem);
-	if (e == NULL)
+	lock_acquire (&frame_lock);
+	f = ohash_find (&frame_table, (uintptr_t) frame);
+	if (f == NULL)
 		printf("No frame to free");
-	else
+	else if (f->inode != NULL)
 	{
-		f = hash_entry (e, struct frame, hash_elem);
-		lock_acquire (&frame_lock);
+		/* Keep a cached page around after its last mapping goes. */
+		ASSERT (f->map_cnt > 0);
+		if (--f->map_cnt == 0)
+		{
+			if (inode_is_removed (f->inode))
+			{
+				uncache (f);
+				victim = f;
+			}
+			else
+			{
+				list_push_back (&idle_pages, &f->idle_elem);
+				if (++idle_cnt > IDLE_MAX)
+					victim = pop_idle ();
+			}
+		}
+	}
+	else if (--f->map_cnt == 0)
+	{
+		ohash_delete (&frame_table, (uintptr_t) frame);
 		palloc_free_page (f->addr);
-		hash_delete (&frame_table, &f->hash_elem);
 		free (f);
+	}
+	lock_release (&frame_lock);
+
+	if (victim != NULL)
+		discard (victim);
+}
+
+/* Adds a mapping of FRAME, which must already be mapped.  It
+   takes one more falloc_free_frame() to free the frame. */
+void
+falloc_share_frame (void *frame)
+{
+	struct frame *f;
+
+	lock_acquire (&frame_lock);
+	f = ohash_find (&frame_table, (uintptr_t) frame);
+	ASSERT (f != NULL && f->map_cnt > 0);
+	f->map_cnt++;
+	lock_release (&frame_lock);
+}
+
+/* Returns a frame with the contents of private frame FRAME that
+   the caller, which maps FRAME at UPAGE, may write without
+   other mappings of FRAME seeing it.  That is FRAME itself if
+   the caller's is the only mapping, otherwise a new copy, in
+   which case the caller's mapping of FRAME is dropped.  Returns
+   a null pointer if memory runs out.
+
+   Every mapping of a shared frame is read-only, so two sharers
+   may copy it at once: the frame is freed only after the last
+   of them has copied it and let go. */
+void *
+falloc_unshare_frame (void *frame, void *upage)
+{
+	struct frame *f;
+	void *copy;
+
+	lock_acquire (&frame_lock);
+	f = ohash_find (&frame_table, (uintptr_t) frame);
+	ASSERT (f != NULL && f->inode == NULL);
+	if (f->map_cnt == 1)
+	{
+		f->thread = thread_current ();
+		f->upage = upage;
 		lock_release (&frame_lock);
+		return frame;
 	}
+	lock_release (&frame_lock);
+
+	copy = falloc_get_frame (upage, PAL_USER);
+	if (copy == NULL)
+		return NULL;
+	memcpy (copy, frame, PGSIZE);
+	falloc_free_frame (frame);
+	return copy;
+}
+
+/* Copies SIZE bytes of INODE starting at OFS, which must all lie
+   within one page, into BUFFER if that page is in the page cache.
+   Returns true if successful, false if the page is not cached. */
+bool
+page_cache_read (struct inode *inode, void *buffer, off_t ofs, off_t size)
+{
+	struct frame *f;
+
+	ASSERT (ofs % PGSIZE + size <= PGSIZE);
+
+	lock_acquire (&frame_lock);
+	f = cache_lookup (inode, ofs - ofs % PGSIZE);
+	if (f != NULL)
+	{
+		memcpy (buffer, (uint8_t *) f->addr + ofs % PGSIZE, size);
+		if (f->map_cnt == 0)
+		{
+			/* Recently used, so move to the back of the idle list. */
+			list_remove (&f->idle_elem);
+			list_push_back (&idle_pages, &f->idle_elem);
+		}
+	}
+	lock_release (&frame_lock);
+	return f != NULL;
+}
+
+/* Updates the cached pages of INODE after SIZE bytes from BUFFER
+   have been written to it starting at OFS. */
+void
+page_cache_write (struct inode *inode, const void *buffer_, off_t ofs,
+                  off_t size)
+{
+	const uint8_t *buffer = buffer_;
+
+	lock_acquire (&frame_lock);
+	cache_gen++;
+	while (size > 0)
+	{
+		off_t page_ofs = ofs % PGSIZE;
+		off_t chunk = PGSIZE - page_ofs < size ? PGSIZE - page_ofs : size;
+		struct frame *f = cache_lookup (inode, ofs - page_ofs);
+
+		if (f != NULL)
+			memcpy ((uint8_t *) f->addr + page_ofs, buffer, chunk);
+		buffer += chunk;
+		ofs += chunk;
+		size -= chunk;
+	}
+	lock_release (&frame_lock);
+}
+
+/* Drops the pages of INODE, which has just been removed, from
+   the page cache: idle pages now, and mapped pages once their
+   last mapping goes. */
+void
+page_cache_remove (struct inode *inode)
+{
+	off_t length = inode_length (inode);
+	off_t ofs;
+
+	for (ofs = 0; ofs < length; ofs += PGSIZE)
+	{
+		struct frame *f;
+
+		lock_acquire (&frame_lock);
+		f = cache_lookup (inode, ofs);
+		if (f != NULL && f->map_cnt == 0)
+		{
+			list_remove (&f->idle_elem);
+			idle_cnt--;
+			uncache (f);
+		}
+		else
+			f = NULL;
+		lock_release (&frame_lock);
+
+		if (f != NULL)
+			discard (f);
+	}
+}
+
+/* Returns the cached frame for the page of INODE at OFS, or a
+   null pointer if there is none.  The caller must hold
+   frame_lock. */
+static struct frame *
+cache_lookup (struct inode *inode, off_t ofs)
+{
+	struct frame key;
+	struct hash_elem *e;
+
+	key.inode = inode;
+	key.ofs = ofs;
+	e = hash_find (&page_cache, &key.cache_elem);
+	return e != NULL ? hash_entry (e, struct frame, cache_elem) : NULL;
+}
+
+/* Removes the least recently used idle page from the page cache
+   and the frame table and returns it, or returns a null pointer
+   if no page is idle.  The caller must hold frame_lock, and must
+   pass the page to discard() after releasing it. */
+static struct frame *
+pop_idle (void)
+{
+	struct frame *f;
+
+	if (list_empty (&idle_pages))
+		return NULL;
+	f = list_entry (list_pop_front (&idle_pages), struct frame, idle_elem);
+	idle_cnt--;
+	uncache (f);
+	return f;
+}
+
+/* Removes cached frame F, which must not be mapped or on the idle
+   list, from the page cache and the frame table.  The caller must
+   hold frame_lock, and must pass F to discard() after releasing
+   it. */
+static void
+uncache (struct frame *f)
+{
+	hash_delete (&page_cache, &f->cache_elem);
+	ohash_delete (&frame_table, (uintptr_t) f->addr);
+}
+
+/* Frees F, which uncache() removed.  Closing the inode may do
+   disk I/O, so frame_lock must not be held.  Like other file
+   system calls, the close is made under file_lock, which the
+   caller may already hold. */
+static void
+discard (struct frame *f)
+{
+	bool locked = lock_held_by_current_thread (&file_lock);
+
+	if (!locked)
+		lock_acquire (&file_lock);
+	inode_close (f->inode);
+	if (!locked)
+		lock_release (&file_lock);
+	palloc_free_page (f->addr);
+	free (f);
+}
+
+/* Returns a hash value for the page cache frame F. */
+static unsigned
+cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+	const struct frame *f = hash_entry (e, struct frame, cache_elem);
+	return hash_bytes (&f->inode, sizeof f->inode) ^ hash_int (f->ofs);
+}
+
+/* Returns true if page cache frame A precedes B. */
+static bool
+cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+	const struct frame *a = hash_entry (a_, struct frame, cache_elem);
+	const struct frame *b = hash_entry (b_, struct frame, cache_elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->ofs < b->ofs;
 }
@@ -2,20 +2,41 @@
 #define VM_FRAME_H
 
 #include <hash.h>
+#include <list.h>
+#include <ohash.h>
 #include "threads/palloc.h"
 #include "threads/thread.h"
+#include "filesys/off_t.h"
+
+struct inode;
 
 struct frame
 {
-	struct hash_elem hash_elem;	/* Hash table element for frame */
-	void *addr;					/* Virtual address */
+	void *addr;					/* Kernel virtual address, the frame table key */
 	struct thread *thread;		/* Keeps track of the frames occupied by process */
 	void *upage;				/* Keeps track of corresponding page */
+
+	int map_cnt;				/* Number of user mappings of the frame */
+
+	/* Page cache, for a frame that holds a page of a file.
+	   INODE is null for a private frame, which fork() may still
+	   share copy-on-write between processes. */
+	struct inode *inode;		/* File the page belongs to */
+	off_t ofs;					/* Page-aligned offset of the page in INODE */
+	struct hash_elem cache_elem;	/* Element in the page cache */
+	struct list_elem idle_elem;	/* Element in idle list while MAP_CNT is 0 */
 };
 
 void frame_init (void);
 
 void *falloc_get_frame (void *, enum palloc_flags);
+void *falloc_get_file_frame (struct inode *, off_t ofs, size_t read_bytes);
 void falloc_free_frame (void *);
+void falloc_share_frame (void *);
+void *falloc_unshare_frame (void *, void *upage);
+
+bool page_cache_read (struct inode *, void *, off_t ofs, off_t size);
+void page_cache_write (struct inode *, const void *, off_t ofs, off_t size);
+void page_cache_remove (struct inode *);
 
 #endif
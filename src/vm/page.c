@@ -1,47 +1,126 @@
-#include <hash.h>
 #include <stdio.h>
-#include "threads/thread.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "vm/page.h"
 
-unsigned sup_page_hash (const struct hash_elem *p_, void *aux UNUSED);
-bool sup_page_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED);
-void sup_page_action (struct hash_elem *e, void *aux UNUSED);
+static struct sup_page **lookup_slot (struct sup_page_table *, const void *, bool);
+static void sup_page_free (struct sup_page *p, void *aux UNUSED);
 
-void
-sup_page_init (struct hash *spt)
+/* Creates an empty supplemental page table.
+   Returns a null pointer if memory allocation fails. */
+struct sup_page_table *
+sup_page_create (void)
 {
-	hash_init (spt, sup_page_hash, sup_page_less, NULL);
+	return palloc_get_page (PAL_ZERO);
 }
 
-/* Returns a hash value for supplementary page table p. */
-unsigned
-sup_page_hash (const struct hash_elem *p_, void *aux UNUSED)
+/* Returns the slot for user page UPAGE in SPT.  If the second
+   level table for UPAGE is missing, creates it if CREATE is true,
+   otherwise returns a null pointer. */
+static struct sup_page **
+lookup_slot (struct sup_page_table *spt, const void *upage, bool create)
 {
-  const struct sup_page *p = hash_entry (p_, struct sup_page, hash_elem);
-  return hash_int ((int)p->addr);
+	struct sup_page ***pde;
+
+	ASSERT (spt != NULL);
+	ASSERT (is_user_vaddr (upage));
+
+	pde = &spt->dir[pd_no (upage)];
+	if (*pde == NULL)
+	{
+		if (!create)
+			return NULL;
+		*pde = palloc_get_page (PAL_ZERO);
+		if (*pde == NULL)
+			return NULL;
+	}
+	return &(*pde)[pt_no (upage)];
 }
 
-/* Returns true if spt a precedes spt b. */
+/* Returns the sup_page for user page UPAGE, or a null pointer if
+   there is none.  Two array lookups, no hashing. */
+struct sup_page *
+sup_page_find (struct sup_page_table *spt, const void *upage)
+{
+	struct sup_page **slot = lookup_slot (spt, pg_round_down (upage), false);
+	return slot != NULL ? *slot : NULL;
+}
+
+/* Adds P to SPT at P->addr.  Returns false if a page is already
+   recorded at that address or memory allocation fails. */
 bool
-sup_page_less (const struct hash_elem *a_, const struct hash_elem *b_,
-           void *aux UNUSED)
+sup_page_insert (struct sup_page_table *spt, struct sup_page *p)
 {
-  const struct sup_page *a = hash_entry (a_, struct sup_page, hash_elem);
-  const struct sup_page *b = hash_entry (b_, struct sup_page, hash_elem);
+	struct sup_page **slot = lookup_slot (spt, p->addr, true);
 
-  return a->addr < b->addr;
+	if (slot == NULL || *slot != NULL)
+		return false;
+	*slot = p;
+	return true;
 }
 
+/* Removes and returns the sup_page for user page UPAGE, or
+   returns a null pointer if there is none.  The caller owns the
+   returned page. */
+struct sup_page *
+sup_page_remove (struct sup_page_table *spt, const void *upage)
+{
+	struct sup_page **slot = lookup_slot (spt, upage, false);
+	struct sup_page *p = NULL;
+
+	if (slot != NULL)
+	{
+		p = *slot;
+		*slot = NULL;
+	}
+	return p;
+}
+
+/* Calls ACTION for each sup_page in SPT with an address in
+   [START, END), in ascending address order.  Second level tables
+   that are absent are skipped whole.  ACTION may remove the page
+   it is given, but must not otherwise modify SPT. */
 void
-sup_page_action (struct hash_elem *e, void *aux UNUSED)
+sup_page_apply (struct sup_page_table *spt, const void *start,
+                const void *end, sup_page_action_func *action, void *aux)
+{
+	uintptr_t addr = (uintptr_t) pg_round_down (start);
+
+	ASSERT (action != NULL);
+
+	if (end > PHYS_BASE)
+		end = PHYS_BASE;
+	while (addr < (uintptr_t) end)
+	{
+		struct sup_page **pt = spt->dir[pd_no ((void *) addr)];
+
+		if (pt == NULL)
+		{
+			/* Skip to the next page directory entry. */
+			addr = (addr & PDMASK) + PTSPAN;
+			continue;
+		}
+		if (pt[pt_no ((void *) addr)] != NULL)
+			action (pt[pt_no ((void *) addr)], aux);
+		addr += PGSIZE;
+	}
+}
+
+static void
+sup_page_free (struct sup_page *p, void *aux UNUSED)
 {
-	struct sup_page *spt = hash_entry (e, struct sup_page, hash_elem);
-	free (spt);
+	free (p);
 }
 
+/* Frees every sup_page in SPT, then SPT itself. */
 void
-sup_page_destroy (struct hash *spt)
+sup_page_destroy (struct sup_page_table *spt)
 {
-	hash_destroy (spt, sup_page_action);
+	size_t i;
+
+	sup_page_apply (spt, NULL, PHYS_BASE, sup_page_free, NULL);
+	for (i = 0; i < SUP_PAGE_DIR_CNT; i++)
+		if (spt->dir[i] != NULL)
+			palloc_free_page (spt->dir[i]);
+	palloc_free_page (spt);
 }
@@ -1,8 +1,10 @@
 #ifndef VM_PAGE_H
 #define VM_PAGE_H
 
-#include <hash.h>
-#include "threads/thread.h"
+#include <stdbool.h>
+#include "threads/loader.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
 #include "filesys/file.h"
 
 enum page_location
@@ -14,7 +16,6 @@ enum page_location
 
 struct sup_page
 {
-	struct hash_elem hash_elem;	/* Hash table element for page */
 	void *addr;					/* Virtual address */
 	enum page_location location;/* Where is the page? */
 
@@ -26,7 +27,28 @@ struct sup_page
 	bool writable;
 };
 
-void sup_page_init (struct hash *);
-void sup_page_destroy (struct hash *);
+/* Number of page directory entries that cover user space. */
+#define SUP_PAGE_DIR_CNT (LOADER_PHYS_BASE >> PDSHIFT)
+
+/* Supplemental page table.  A two-level radix tree shaped like
+   the x86 page directory: DIR is indexed by pd_no() of a user
+   address and each non-null entry points to a page-sized table
+   of sup_page pointers indexed by pt_no(). */
+struct sup_page_table
+{
+	struct sup_page **dir[SUP_PAGE_DIR_CNT];
+};
+
+/* Performs some operation on sup_page P, given auxiliary data AUX. */
+typedef void sup_page_action_func (struct sup_page *p, void *aux);
+
+struct sup_page_table *sup_page_create (void);
+void sup_page_destroy (struct sup_page_table *);
+
+struct sup_page *sup_page_find (struct sup_page_table *, const void *upage);
+bool sup_page_insert (struct sup_page_table *, struct sup_page *);
+struct sup_page *sup_page_remove (struct sup_page_table *, const void *upage);
+void sup_page_apply (struct sup_page_table *, const void *start,
+                     const void *end, sup_page_action_func *, void *aux);
 
 #endif